@@ -0,0 +1,855 @@
+// Micro-benchmarks for the parts of the simulation that are hard to see in
+// a whole-frame run. Each one builds exactly the world it needs from a
+// fixed seed, so numbers are comparable between builds.
+//
+//   bench route [obstacles] [queries] [route cache MiB]
+//   bench navbuild [obstacles] [check]
+//   bench obstruct [obstacles] [queries]
+//   bench nearest [characters] [queries] [idim]
+//   bench fixtures [fixtures] [rounds]
+//   bench fixed [exhaustive bits] [samples]
+//   bench snapshot [characters] [idim]
+
+#define FRAMERATE 60
+
+// room for the bigger obstacle counts below
+#ifndef OBSTACLE_CAP
+#define OBSTACLE_CAP 10240
+#endif
+
+#include "data.h"
+#include "sim.h"
+#include "snapshot.h"
+
+// walls laid out on a jittered grid like init() does, but shrunk to fit as
+// many as asked for, so the world stays about as open
+void bench_obstacles(struct Rng *rng, size_t count) {
+	obstacle_count = 0;
+	size_t cols = 1;
+	while (cols * cols < count) {
+		cols += 1;
+	}
+	const num SPACING = 2*DIM/cols;
+	range (i, count) {
+		const int g = 1000;
+		const num RANGE = SPACING/4;
+		num x = -DIM + SPACING/2 + i%cols*SPACING + rand_int(rng, g)*RANGE/g;
+		num y = -DIM + SPACING/2 + i/cols*SPACING + rand_int(rng, g)*RANGE/g;
+		num dx = SPACING / 40;
+		num dy = SPACING * 2 / 5;
+		if (rng_next(rng) % 2) {
+			dx = SPACING * 2 / 5;
+			dy = SPACING / 40;
+		}
+		obstacles[i].l = x - dx;
+		obstacles[i].r = x + dx;
+		obstacles[i].b = y - dy;
+		obstacles[i].t = y + dy;
+		obstacle_count += 1;
+	}
+}
+
+num path_length(num x, num y, num endx, num endy, size_t count, nav *path) {
+	num total = 0;
+	for (size_t k = count; k > 0; k--) {
+		struct NavNode *n = &nav_nodes[path[k-1].i];
+		total += fx_hypot(n->x - x, n->y - y);
+		x = n->x;
+		y = n->y;
+	}
+	return total + fx_hypot(endx - x, endy - y);
+}
+
+// routes every query, returning how many were found and their total length
+size_t bench_route_queries(
+	num *points, size_t queries, bool cached, num *total_length
+) {
+	static struct RouteScratch scratch;
+	static nav path[NAV_NODE_CAP];
+	size_t found = 0;
+	*total_length = 0;
+	range (q, queries) {
+		num *p = &points[4*q];
+		size_t count;
+		if (cached) {
+			pick_route_cached(&scratch, p[0], p[1], p[2], p[3], &count, path);
+			route_cache_end_batch();
+		} else {
+			pick_route(&scratch, p[0], p[1], p[2], p[3], &count, path);
+		}
+		if (count > 0) {
+			found += 1;
+			*total_length += path_length(p[0], p[1], p[2], p[3], count, path);
+		}
+	}
+	return found;
+}
+
+void bench_route(size_t obstacles, size_t queries, size_t cache_mb) {
+	struct Rng rng = rng_stream(1, 0);
+	bench_obstacles(&rng, min(obstacles, OBSTACLE_CAP));
+	initialize_nav_edges(-DIM, DIM, -DIM, DIM);
+	printf("route: %lu obstacles, %lu nav nodes, %lu edges\n",
+		obstacle_count, nav_node_count, nav_edge_count / 2);
+
+	num *points = malloc(queries * 4 * sizeof(num));
+	range (q, queries) {
+		rand_pos_in_space(&rng, &points[4*q], &points[4*q+1]);
+		rand_pos_in_space(&rng, &points[4*q+2], &points[4*q+3]);
+	}
+
+	num length;
+	uint64_t start = now_ns();
+	size_t found = bench_route_queries(points, queries, false, &length);
+	uint64_t elapsed = now_ns() - start;
+
+	// the visibility tests pick_route starts with, on their own, to tell
+	// how much of the time is the search proper
+	static bool start_clear[NAV_NODE_CAP], end_clear[NAV_NODE_CAP];
+	size_t clear = 0;
+	start = now_ns();
+	range (q, queries) {
+		num *p = &points[4*q];
+		nav_node_visibility(p[0], p[1], false, start_clear);
+		nav_node_visibility(p[2], p[3], true, end_clear);
+		range (i, nav_node_count) {
+			clear += start_clear[i] + end_clear[i];
+		}
+	}
+	uint64_t visibility = now_ns() - start;
+
+	printf("route: %lu queries, %.2f us per query (%.2f us visibility, %.2f us search),"
+		" %lu found, mean length %.3f units, %lu clear lines\n",
+		queries, (double)elapsed / queries / 1e3,
+		(double)visibility / queries / 1e3,
+		(double)(elapsed - min(visibility, elapsed)) / queries / 1e3,
+		found, found ? (double)length / found / UNIT : 0.0, clear);
+
+	// the same queries through the route cache, cold and then warm
+	route_cache_clear();
+	route_cache.cap_bytes = cache_mb << 20;
+	range (pass, 2) {
+		num cached_length;
+		start = now_ns();
+		size_t cached_found =
+			bench_route_queries(points, queries, true, &cached_length);
+		elapsed = now_ns() - start;
+		printf("route cache %s: %.2f us per query, %lu found, mean length %.3f units\n",
+			pass ? "warm" : "cold", (double)elapsed / queries / 1e3, cached_found,
+			cached_found ? (double)cached_length / cached_found / UNIT : 0.0);
+	}
+	route_cache_print_stats();
+	free(points);
+}
+
+// Times building the visibility graph with the sweep, and if check is set
+// also with the brute force, failing if the two graphs differ at all. The
+// brute force is O(N^2 M), so checking much past 1k obstacles takes a while.
+void bench_navbuild(size_t obstacles, bool check) {
+	struct Rng rng = rng_stream(1, 0);
+	bench_obstacles(&rng, min(obstacles, OBSTACLE_CAP));
+	initialize_nav_nodes(-DIM, DIM, -DIM, DIM);
+
+	uint64_t start = now_ns();
+	build_nav_edges_sweep();
+	uint64_t sweep = now_ns() - start;
+	size_t edges = nav_edge_count;
+	size_t bytes = (nav_node_count + 1) * sizeof(uint32_t)
+		+ edges * (sizeof(uint32_t) + sizeof(num));
+	printf("navbuild: %lu obstacles, %lu nav nodes, %lu edges, sweep %.3f s\n",
+		obstacle_count, nav_node_count, edges / 2, (double)sweep / 1e9);
+	// against a square array of 16 byte (index, distance) entries
+	printf("navbuild: graph takes %.1f KiB, %.1f MiB as a dense array\n",
+		bytes / 1024.0,
+		(double)nav_node_count * nav_node_count * 16 / (1 << 20));
+	if (!check) {
+		return;
+	}
+
+	uint32_t *starts = malloc((nav_node_count + 1) * sizeof(uint32_t));
+	uint32_t *to = malloc(edges * sizeof(uint32_t));
+	num *dist = malloc(edges * sizeof(num));
+	memcpy(starts, nav_edge_start, (nav_node_count + 1) * sizeof(uint32_t));
+	memcpy(to, nav_edge_to, edges * sizeof(uint32_t));
+	memcpy(dist, nav_edge_dist, edges * sizeof(num));
+
+	start = now_ns();
+	build_nav_edges_brute_force();
+	uint64_t brute = now_ns() - start;
+
+	size_t mismatched = 0;
+	range (i, nav_node_count) {
+		bool same = starts[i] == nav_edge_start[i]
+			&& starts[i + 1] == nav_edge_start[i + 1];
+		for (uint32_t e = starts[i]; same && e < starts[i + 1]; e++) {
+			same = to[e] == nav_edge_to[e] && dist[e] == nav_edge_dist[e];
+		}
+		mismatched += !same;
+	}
+	printf("navbuild: brute force %.3f s, %.1fx slower, %s\n",
+		(double)brute / 1e9, (double)brute / sweep,
+		mismatched ? "GRAPHS DIFFER" : "graphs identical");
+	free(starts);
+	free(to);
+	free(dist);
+	if (mismatched) {
+		printf("ERROR: %lu nav nodes have different edges\n", mismatched);
+		exit(1);
+	}
+}
+
+// time the segments in points through interval_obstructed_linear and
+// interval_obstructed, counting any they disagree on
+void bench_obstruct_queries(char *name, num *points, size_t queries) {
+	bool *expected = malloc(queries);
+	uint64_t start = now_ns();
+	range (q, queries) {
+		num *p = &points[4*q];
+		expected[q] = interval_obstructed_linear(p[0], p[1], p[2], p[3]);
+	}
+	uint64_t linear = now_ns() - start;
+
+	size_t blocked = 0;
+	size_t mismatched = 0;
+	start = now_ns();
+	range (q, queries) {
+		num *p = &points[4*q];
+		bool result = interval_obstructed(p[0], p[1], p[2], p[3]);
+		blocked += result;
+		mismatched += result != expected[q];
+	}
+	uint64_t grid = now_ns() - start;
+
+	printf("obstruct %s: linear %.1f ns, grid %.1f ns, %.1fx faster, %.1f%% blocked\n",
+		name, (double)linear / queries, (double)grid / queries,
+		(double)linear / grid, 100.0 * blocked / queries);
+	free(expected);
+	if (mismatched) {
+		printf("ERROR: grid and linear scan disagree on %lu segments\n", mismatched);
+		exit(1);
+	}
+}
+
+// obstruct_one and obstruct_lanes against obstacle_blocks on random
+// rectangles and segments, on lattices fine enough that lines often pass
+// within rounding of a corner, and out to OBSTRUCT_COORD_LIMIT
+void bench_obstruct_exact(size_t trials) {
+	struct Rng rng = rng_stream(2, 0);
+	const num scales[] = {1, 7, UNIT, OBSTRUCT_COORD_LIMIT / 32 - 1};
+	size_t blocked = 0;
+	size_t mismatched = 0;
+	range (trial, trials) {
+		num scale = scales[trial % 4];
+		num lrbt[4][OBSTRUCT_LANES];
+		range (lane, OBSTRUCT_LANES) {
+			num x = rand_int(&rng, 16) * scale;
+			num y = rand_int(&rng, 16) * scale;
+			lrbt[0][lane] = x;
+			lrbt[1][lane] = x + (1 + rng_next(&rng) % 8) * scale;
+			lrbt[2][lane] = y;
+			lrbt[3][lane] = y + (1 + rng_next(&rng) % 8) * scale;
+		}
+		num p[4];
+		range (k, 4) {
+			p[k] = rand_int(&rng, 31) * scale;
+			if (rng_next(&rng) % 2) {
+				p[k] += rand_int(&rng, scale);
+			}
+		}
+		struct ObstructSegment seg = obstruct_segment(p[0], p[1], p[2], p[3]);
+		int mask = obstruct_lanes(&seg, lrbt[0], lrbt[1], lrbt[2], lrbt[3]);
+		range (lane, OBSTRUCT_LANES) {
+			struct Obstacle o = {
+				lrbt[0][lane], lrbt[1][lane], lrbt[3][lane], lrbt[2][lane]
+			};
+			bool expected = obstacle_blocks(&o, p[0], p[1], p[2], p[3]);
+			bool one = obstruct_one(&seg, o.l, o.r, o.b, o.t);
+			blocked += expected;
+			mismatched += expected != one;
+			mismatched += expected != !!(mask & 1 << lane);
+		}
+	}
+	printf("obstruct exact: %lu segment and rectangle pairs, %lu blocked, %d lanes\n",
+		trials * OBSTRUCT_LANES, blocked, OBSTRUCT_LANES);
+	if (mismatched) {
+		printf("ERROR: division free tests disagree with obstacle_blocks %lu times\n",
+			mismatched);
+		exit(1);
+	}
+}
+
+// Segments of three kinds: between random points anywhere, short ones
+// about the length of a character's walk between corners, and ones between
+// obstacle corners, which graze obstacles the way nav edges do.
+void bench_obstruct(size_t count, size_t queries) {
+	struct Rng rng = rng_stream(1, 0);
+	bench_obstacles(&rng, min(count, OBSTACLE_CAP));
+	build_obstacle_grid();
+	printf("obstruct: %lu obstacles, %ldx%ld grid, %u listings\n",
+		obstacle_count, obstacle_grid.cols, obstacle_grid.rows,
+		obstacle_grid.cell_start[obstacle_grid.cols * obstacle_grid.rows]);
+
+	num *points = malloc(queries * 4 * sizeof(num));
+	range (q, queries) {
+		rand_pos_in_space(&rng, &points[4*q], &points[4*q+1]);
+		rand_pos_in_space(&rng, &points[4*q+2], &points[4*q+3]);
+	}
+	bench_obstruct_queries("long", points, queries);
+
+	// a couple of the gaps bench_obstacles leaves
+	size_t cols = 1;
+	while (cols * cols < obstacle_count) {
+		cols += 1;
+	}
+	num reach = 4 * DIM / cols;
+	range (q, queries) {
+		num *p = &points[4*q];
+		p[2] = p[0] + rand_int(&rng, reach);
+		p[3] = p[1] + rand_int(&rng, reach);
+	}
+	bench_obstruct_queries("short", points, queries);
+
+	range (q, queries) {
+		num *p = &points[4*q];
+		range (end, 2) {
+			struct Obstacle *o = &obstacles[rng_next(&rng) % obstacle_count];
+			int corner = rng_next(&rng) % 4;
+			p[2*end] = corner & 1 ? o->r : o->l;
+			p[2*end+1] = corner & 2 ? o->t : o->b;
+		}
+	}
+	bench_obstruct_queries("corners", points, queries);
+
+	// every nav node against one point, as pick_route starts with
+	initialize_nav_nodes(-DIM, DIM, -DIM, DIM);
+	static bool fan[NAV_NODE_CAP];
+	size_t fans = max(queries / nav_node_count, 1);
+	size_t mismatched = 0;
+	uint64_t single = 0, batched = 0;
+	range (q, fans) {
+		num *p = &points[4*q];
+		bool from_nodes = q % 2;
+		uint64_t start = now_ns();
+		nav_node_visibility(p[0], p[1], from_nodes, fan);
+		batched += now_ns() - start;
+		start = now_ns();
+		range (i, nav_node_count) {
+			bool clear = from_nodes
+				? !interval_obstructed(nav_nodes[i].x, nav_nodes[i].y, p[0], p[1])
+				: !interval_obstructed(p[0], p[1], nav_nodes[i].x, nav_nodes[i].y);
+			mismatched += clear != fan[i];
+		}
+		single += now_ns() - start;
+	}
+	size_t segments = fans * nav_node_count;
+	printf("obstruct fan: one at a time %.1f ns, nav_node_visibility %.1f ns\n",
+		(double)single / segments, (double)batched / segments);
+	if (mismatched) {
+		printf("ERROR: nav_node_visibility disagrees on %lu segments\n", mismatched);
+		exit(1);
+	}
+	free(points);
+}
+
+struct NearestCandidate {
+	num qu;
+	uint64_t order;
+	ref r;
+};
+
+int cmp_nearest_candidate(const void *a, const void *b) {
+	const struct NearestCandidate *x = a, *y = b;
+	if (x->qu != y->qu) {
+		return x->qu < y->qu ? -1 : 1;
+	}
+	return (x->order > y->order) - (x->order < y->order);
+}
+
+// the k nearest, by sorting everything in range
+size_t nearest_sorted(
+	num x, num y, num r, bool (*cond)(ref x, size_t who),
+	struct NearestCandidate *candidates
+) {
+	size_t cl, cr, cu, cd;
+	chunk_range(x, y, r, &cl, &cr, &cu, &cd);
+	size_t count = 0;
+	for (size_t di = cl; di <= cr; di++) {
+		for (size_t dj = cu; dj <= cd; dj++) {
+			struct Chunk *chunk = chunk_at(di, dj);
+			range (k, chunk->total_num) {
+				ref it = chunk->refs[k];
+				if (!cond(it, 0)) continue;
+				num itx, ity;
+				ref_pos(it, &itx, &ity);
+				num qu = (itx - x) * (itx - x) + (ity - y) * (ity - y);
+				if (qu < r * r) {
+					candidates[count++] = (struct NearestCandidate){
+						qu, chunk_order(di, dj, k), it
+					};
+				}
+			}
+		}
+	}
+	qsort(candidates, count, sizeof(struct NearestCandidate), cmp_nearest_candidate);
+	return count;
+}
+
+ItemType bench_holding;
+
+bool holds_bench_type(ref x, size_t who) {
+	if ((x & REF_SORT) != REF_FIXTURE) {
+		return false;
+	}
+	Fixture fx = &fixtures[x & REF_IND];
+	range (j, fx->storage_count) {
+		if (fx->storage[j].type == bench_holding) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// find_nearest, find_k_nearest and find_nearest_holding against scanning
+// every chunk in range, from where characters stand, as decisions search.
+// A second of simulation first leaves fixtures made, moved between and
+// evolved, for the item type lists to have kept up with.
+void bench_nearest(size_t count, size_t queries, size_t idim) {
+	world_idim = idim;
+	char_initial = count;
+	init();
+	range (f, FRAMERATE) {
+		frame++;
+		simulate();
+	}
+
+	const char *names[] = {"characters", "fixtures"};
+	bool (*conds[])(ref, size_t) = {is_char, is_fixture};
+	ref *expected = malloc(queries * sizeof(ref));
+	size_t mismatched = 0;
+	range (c, 2) {
+		uint64_t start = now_ns();
+		range (q, queries) {
+			size_t i = q % char_count;
+			expected[q] = find_nearest_scan(chars.x[i], chars.y[i], AWARENESS, conds[c], 0);
+		}
+		uint64_t scan = now_ns() - start;
+		start = now_ns();
+		range (q, queries) {
+			size_t i = q % char_count;
+			mismatched += find_nearest(chars.x[i], chars.y[i], AWARENESS, conds[c], 0) != expected[q];
+		}
+		uint64_t rings = now_ns() - start;
+		printf("nearest %s: scan %.1f ns, rings %.1f ns, %.1fx faster\n",
+			names[c], (double)scan / queries, (double)rings / queries,
+			(double)scan / rings);
+	}
+
+	const size_t k = 8;
+	struct NearestCandidate *candidates = malloc(
+		(char_count + fixture_count) * sizeof(struct NearestCandidate));
+	uint64_t rings = 0;
+	range (q, queries) {
+		size_t i = q % char_count;
+		ref out[8];
+		uint64_t start = now_ns();
+		size_t found = find_k_nearest(chars.x[i], chars.y[i], AWARENESS, is_char, 0, out, k);
+		rings += now_ns() - start;
+		size_t n = nearest_sorted(chars.x[i], chars.y[i], AWARENESS, is_char, candidates);
+		mismatched += found != min(n, k);
+		range (j, min(found, n)) {
+			mismatched += out[j] != candidates[j].r;
+		}
+	}
+	printf("nearest %lu characters: rings %.1f ns\n", k, (double)rings / queries);
+
+	uint64_t scan = 0;
+	rings = 0;
+	range (q, queries) {
+		size_t i = q % char_count;
+		bench_holding = &item_types[q % item_type_count];
+		uint64_t start = now_ns();
+		ref expected = find_nearest_scan(chars.x[i], chars.y[i], AWARENESS, holds_bench_type, 0);
+		scan += now_ns() - start;
+		start = now_ns();
+		ref found = find_nearest_holding(chars.x[i], chars.y[i], AWARENESS, bench_holding, is_fixture, 0);
+		rings += now_ns() - start;
+		mismatched += found != expected;
+	}
+	printf("nearest fixture holding a type: scan %.1f ns, type lists %.1f ns, %.1fx faster\n",
+		(double)scan / queries, (double)rings / queries, (double)scan / rings);
+	free(candidates);
+	free(expected);
+	if (mismatched) {
+		printf("ERROR: ring search and scan disagree %lu times\n", mismatched);
+		exit(1);
+	}
+}
+
+// A world holding count fixtures where a hundredth of them are destroyed
+// and as many made each round, as crafting does, in each fixture order.
+void bench_fixtures(size_t count, size_t rounds) {
+	size_t idim = 1;
+	while (idim * idim / 16 < count + count / 8) {
+		idim += 1;
+	}
+	const char *names[] = {"dense", "sorted"};
+	enum FixtureOrder orders[] = {FIXTURE_ORDER_DENSE, FIXTURE_ORDER_SORTED};
+	range (o, 2) {
+		world_idim = idim;
+		char_initial = 0;
+		fixture_order = orders[o];
+		init();
+		struct Rng rng = rng_stream(3, 0);
+		struct Item it = {-1, &item_types[0]};
+		while (fixture_count < count) {
+			num x, y;
+			rand_pos_in_space(&rng, &x, &y);
+			create_fixture(x, y, it);
+		}
+
+		size_t churn = max(count / 100, 1);
+		uint64_t destroy_ns = 0, create_ns = 0, sort_ns = 0;
+		range (round, rounds) {
+			uint64_t start = now_ns();
+			range (k, churn) {
+				Fixture fx = live_fixtures[rng_next(&rng) % fixture_count];
+				destroy_fixture(fx - fixtures);
+			}
+			destroy_ns += now_ns() - start;
+			start = now_ns();
+			range (k, churn) {
+				num x, y;
+				rand_pos_in_space(&rng, &x, &y);
+				create_fixture(x, y, it);
+			}
+			create_ns += now_ns() - start;
+			// what the item phase does first
+			start = now_ns();
+			sort_live_fixtures();
+			sort_ns += now_ns() - start;
+		}
+		size_t ops = churn * rounds;
+		printf("fixtures %s: %lu live, destroy %.1f ns, create %.1f ns, ordering %.3f ms per round\n",
+			names[o], fixture_count, (double)destroy_ns / ops,
+			(double)create_ns / ops, (double)sort_ns / rounds / 1e6);
+	}
+	fixture_order = FIXTURE_ORDER_DENSE;
+}
+
+// The square roots fixed.h replaced, as util.h had them, to compare against.
+num invsqrt_nr(num x) {
+	if (!x) x = 1;
+	if (x >= (num)1 << 46) {
+		return invsqrt_nr(x / 4) / 2;
+	}
+	num y = UNIT;
+	while (x*y/UNIT*y/UNIT > 3 * UNIT / 2) {
+		y = y * 5 / 7;
+	}
+	while (x*y/UNIT*y/UNIT < 2 * UNIT / 3) {
+		y = y * 7 / 5;
+	}
+	y = y * (UNIT * 3 / 2 - x*y/UNIT*y/UNIT/2)/UNIT;
+	y = y * (UNIT * 3 / 2 - x*y/UNIT*y/UNIT/2)/UNIT;
+	y = y * (UNIT * 3 / 2 - x*y/UNIT*y/UNIT/2)/UNIT;
+	return y;
+}
+
+#define HYPOT_LIMIT ((num)1 << 24)
+int hypot_shift(num x, num y) {
+	if (x < 0) x = -x;
+	if (y < 0) y = -y;
+	int shift = 0;
+	while (x >> shift >= HYPOT_LIMIT || y >> shift >= HYPOT_LIMIT) {
+		shift += 1;
+	}
+	return shift;
+}
+
+num num_hypot(num x, num y) {
+	int shift = hypot_shift(x, y);
+	x /= (num)1 << shift;
+	y /= (num)1 << shift;
+	num qu = (x*x + y*y)/UNIT;
+	return qu * invsqrt_nr(qu) / UNIT << shift;
+}
+
+// whether r is floor(sqrt(x))
+bool isqrt_exact(uint64_t x, uint64_t r) {
+	return r <= 0xffffffffULL && r * r <= x && x - r * r <= 2 * r;
+}
+
+// Checks fx_isqrt on every input below 2^bits, on both sides of every
+// seed table boundary at every shift, around the largest roots there are,
+// and on samples of every bit length, then fx_hypot and fx_invsqrt on
+// samples, reporting how far off the old functions were on the same ones.
+void bench_fixed_exact(size_t bits, size_t samples) {
+	size_t checked = 0;
+	size_t wrong = 0;
+	for (uint64_t x = 0; x < (uint64_t)1 << bits; x++) {
+		wrong += !isqrt_exact(x, fx_isqrt(x));
+	}
+	checked += (size_t)1 << bits;
+	for (uint64_t top = 64; top < 256; top++) {
+		range (half, 32) {
+			uint64_t lo = top << 56 >> 2 * half;
+			uint64_t hi = (top == 255 ? ~0ULL : ((top + 1) << 56) - 1) >> 2 * half;
+			uint64_t xs[4] = {lo, lo + 1, hi - 1, hi};
+			range (k, 4) {
+				wrong += !isqrt_exact(xs[k], fx_isqrt(xs[k]));
+			}
+			checked += 4;
+		}
+	}
+	for (uint64_t r = 0xffffffffULL - 65536; r <= 0xffffffffULL; r++) {
+		uint64_t xs[3] = {r * r - 1, r * r, r * r + 2 * r};
+		range (k, 3) {
+			wrong += !isqrt_exact(xs[k], fx_isqrt(xs[k]));
+		}
+		checked += 3;
+	}
+	struct Rng rng = rng_stream(4, 0);
+	range (k, samples) {
+		uint64_t x = rng_next(&rng) >> k % 64;
+		wrong += !isqrt_exact(x, fx_isqrt(x));
+	}
+	checked += samples;
+	printf("fixed isqrt: %lu inputs, all below 2^%lu\n", checked, bits);
+	if (wrong) {
+		printf("ERROR: fx_isqrt wrong on %lu of them\n", wrong);
+		exit(1);
+	}
+
+	// differences up to 2^31, the most two points in the world can be apart
+	num old_worst = 0;
+	double old_worst_rel = 0;
+	range (k, samples) {
+		int length = 1 + k % 31;
+		num x = (num)(rng_next(&rng) >> (64 - length)) * (rng_next(&rng) % 2 ? 1 : -1);
+		num y = (num)(rng_next(&rng) >> (64 - length)) * (rng_next(&rng) % 2 ? 1 : -1);
+		uint64_t qu = (uint64_t)(x * x) + (uint64_t)(y * y);
+		num exact = fx_isqrt(qu);
+		wrong += fx_hypot(x, y) != exact || !isqrt_exact(qu, exact);
+		num off = num_hypot(x, y) - exact;
+		off = off < 0 ? -off : off;
+		old_worst = max(old_worst, off);
+		if (exact > 0) {
+			old_worst_rel = max(old_worst_rel, (double)off / exact);
+		}
+	}
+	printf("fixed hypot: %lu samples, num_hypot was off by up to %ld (%.2g of the length)\n",
+		samples, old_worst, old_worst_rel);
+	if (wrong) {
+		printf("ERROR: fx_hypot wrong on %lu of them\n", wrong);
+		exit(1);
+	}
+
+	// the answer rounded down is floor(sqrt(2^48 / x))
+	range (k, samples) {
+		int length = 1 + k % 62;
+		num x = rng_next(&rng) >> (64 - length);
+		x = max(x, 1);
+		num off = fx_invsqrt(x) - fx_isqrt(((uint64_t)1 << 48) / x);
+		wrong += off < 0 || off > 1;
+	}
+	// invsqrt_nr only ever saw squared lengths up to HYPOT_LIMIT, and past
+	// 2^44 or so it can round y to 0 and loop forever, so it's kept apart
+	old_worst_rel = 0;
+	range (k, samples) {
+		int length = 1 + k % 32;
+		num x = rng_next(&rng) >> (64 - length);
+		x = max(x, 1);
+		num exact = fx_isqrt(((uint64_t)1 << 48) / x);
+		num off = invsqrt_nr(x) - exact;
+		off = off < 0 ? -off : off;
+		old_worst_rel = max(old_worst_rel, (double)off / exact);
+	}
+	printf("fixed invsqrt: %lu samples, invsqrt_nr was off by up to %.2g of the answer\n",
+		samples, old_worst_rel);
+	if (wrong) {
+		printf("ERROR: fx_invsqrt more than one off on %lu of them\n", wrong);
+		exit(1);
+	}
+}
+
+// Lengths of the kind the simulation asks for: legs of a walk, nav edges,
+// and distances across the whole world.
+void bench_fixed(size_t count) {
+	struct Rng rng = rng_stream(4, 1);
+	num *dx = malloc(count * sizeof(num));
+	num *dy = malloc(count * sizeof(num));
+	num *out = malloc(count * sizeof(num));
+	range (k, count) {
+		num reach = k % 3 == 0 ? UNIT * 4 : k % 3 == 1 ? DIM / 8 : 2 * DIM;
+		dx[k] = rand_int(&rng, reach);
+		dy[k] = rand_int(&rng, reach);
+	}
+	// the sums keep the loops from being optimised away
+	num sum = 0;
+	uint64_t start = now_ns();
+	range (k, count) {
+		sum += num_hypot(dx[k], dy[k]);
+	}
+	uint64_t old_hypot = now_ns() - start;
+	start = now_ns();
+	range (k, count) {
+		sum -= fx_hypot(dx[k], dy[k]);
+	}
+	uint64_t new_hypot = now_ns() - start;
+	// once untimed, so out has been touched and page faults aren't counted,
+	// then against a loop storing to out the same way
+	fx_hypot_batch(dx, dy, out, count);
+	start = now_ns();
+	range (k, count) {
+		out[k] = fx_hypot(dx[k], dy[k]);
+	}
+	uint64_t loop_hypot = now_ns() - start;
+	start = now_ns();
+	fx_hypot_batch(dx, dy, out, count);
+	uint64_t batch_hypot = now_ns() - start;
+	range (k, count) {
+		dx[k] = max((dx[k] * dx[k] + dy[k] * dy[k]) / UNIT, 1);
+	}
+	start = now_ns();
+	range (k, count) {
+		sum += invsqrt_nr(dx[k]);
+	}
+	uint64_t old_invsqrt = now_ns() - start;
+	start = now_ns();
+	range (k, count) {
+		sum -= fx_invsqrt(dx[k]);
+	}
+	uint64_t new_invsqrt = now_ns() - start;
+	printf("fixed hypot: num_hypot %.1f ns, fx_hypot %.1f ns, storing %.1f ns, fx_hypot_batch %.1f ns\n",
+		(double)old_hypot / count, (double)new_hypot / count,
+		(double)loop_hypot / count, (double)batch_hypot / count);
+	printf("fixed invsqrt: invsqrt_nr %.1f ns, fx_invsqrt %.1f ns (%ld, %ld)\n",
+		(double)old_invsqrt / count, (double)new_invsqrt / count,
+		sum, out[count / 2]);
+	free(dx);
+	free(dy);
+	free(out);
+}
+
+// Building a world against saving it, checkpointing it and loading it back,
+// and a check that the loaded world carries on exactly as the original did.
+void bench_snapshot(size_t count, size_t idim) {
+	const char *path = "bench.snap";
+	world_idim = idim;
+	char_initial = count;
+	uint64_t start = now_ns();
+	init();
+	uint64_t init_ns = now_ns() - start;
+	range (f, FRAMERATE) {
+		frame++;
+		simulate();
+	}
+	uint64_t saved_hash = sim_hash();
+
+	start = now_ns();
+	snapshot_save(path);
+	uint64_t save_ns = now_ns() - start;
+	// how long the simulation stops for, the child does the rest
+	start = now_ns();
+	snapshot_checkpoint(path);
+	uint64_t fork_ns = now_ns() - start;
+	snapshot_checkpoint_reap(true);
+
+	range (f, FRAMERATE) {
+		frame++;
+		simulate();
+	}
+	uint64_t expected = sim_hash();
+
+	start = now_ns();
+	snapshot_load(path);
+	uint64_t load_ns = now_ns() - start;
+	bool same = sim_hash() == saved_hash;
+	range (f, FRAMERATE) {
+		frame++;
+		simulate();
+	}
+	same = same && sim_hash() == expected;
+	remove(path);
+
+	printf("snapshot %lu characters: init %.3f ms, save %.3f ms, checkpoint pause %.3f ms, load %.3f ms\n",
+		char_count, (double)init_ns / 1e6, (double)save_ns / 1e6,
+		(double)fork_ns / 1e6, (double)load_ns / 1e6);
+	if (!same) {
+		printf("ERROR: the loaded world went a different way\n");
+		exit(1);
+	}
+}
+
+void usage(char *name) {
+	printf("usage: %s route [obstacles] [queries] [route cache MiB]\n", name);
+	printf("       %s navbuild [obstacles] [check]\n", name);
+	printf("       %s obstruct [obstacles] [queries]\n", name);
+	printf("       %s nearest [characters] [queries] [idim]\n", name);
+	printf("       %s fixtures [fixtures] [rounds]\n", name);
+	printf("       %s fixed [exhaustive bits] [samples]\n", name);
+	printf("       %s snapshot [characters] [idim]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		usage(argv[0]);
+	}
+	if (strcmp(argv[1], "route") == 0) {
+		bench_route(
+			argc > 2 ? atol(argv[2]) : 250,
+			argc > 3 ? atol(argv[3]) : 2000,
+			argc > 4 ? atol(argv[4]) : 16
+		);
+	} else if (strcmp(argv[1], "navbuild") == 0) {
+		if (argc > 2) {
+			bench_navbuild(atol(argv[2]), argc > 3 ? atol(argv[3]) : true);
+		} else {
+			bench_navbuild(256, true);
+			bench_navbuild(1024, true);
+			bench_navbuild(4096, false);
+		}
+	} else if (strcmp(argv[1], "obstruct") == 0) {
+		size_t queries = argc > 3 ? atol(argv[3]) : 100000;
+		bench_obstruct_exact(10 * queries);
+		if (argc > 2) {
+			bench_obstruct(atol(argv[2]), queries);
+		} else {
+			bench_obstruct(100, queries);
+			bench_obstruct(1000, queries);
+			bench_obstruct(10000, queries);
+		}
+	} else if (strcmp(argv[1], "nearest") == 0) {
+		parse_data();
+		size_t queries = argc > 3 ? atol(argv[3]) : 100000;
+		if (argc > 2) {
+			bench_nearest(atol(argv[2]), queries, argc > 4 ? atol(argv[4]) : IDIM);
+		} else {
+			bench_nearest(2000, queries, IDIM);
+			bench_nearest(12000, queries, 256);
+			bench_nearest(40000, queries, 100);
+		}
+	} else if (strcmp(argv[1], "fixtures") == 0) {
+		parse_data();
+		bench_fixtures(
+			argc > 2 ? atol(argv[2]) : 100000,
+			argc > 3 ? atol(argv[3]) : 100
+		);
+	} else if (strcmp(argv[1], "fixed") == 0) {
+		size_t samples = argc > 3 ? atol(argv[3]) : 10000000;
+		bench_fixed_exact(argc > 2 ? atol(argv[2]) : 28, samples);
+		bench_fixed(samples);
+	} else if (strcmp(argv[1], "snapshot") == 0) {
+		parse_data();
+		if (argc > 2) {
+			bench_snapshot(atol(argv[2]), argc > 3 ? atol(argv[3]) : IDIM);
+		} else {
+			bench_snapshot(2000, IDIM);
+			bench_snapshot(12000, 256);
+		}
+	} else {
+		usage(argv[0]);
+	}
+	return 0;
+}
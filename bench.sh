@@ -0,0 +1,2 @@
+#!/bin/sh
+cc -O2 -march=native $CFLAGS bench.c -o bench -DNDEBUG -lpthread && ./bench "$@"
@@ -1,2 +1,2 @@
 #!/bin/sh
-tcc `pkg-config --static --libs glfw3` -lvulkan main.c -DNDEBUG
+tcc `pkg-config --static --libs glfw3` -lvulkan -lpthread main.c -DNDEBUG
@@ -156,9 +156,9 @@ long token_get_num(char **str, long unit) {
 	return t.whole * unit + t.nume * unit / t.denom;
 }
 
-void parse_data() {
-	FILE* f = fopen("data.txt", "r");
-
+// reads the item types and recipes in f, which can be data.txt or, when
+// replaying, the copy of it in the replay log
+void parse_data_from(FILE *f) {
 	enum {
 		PARSE_STATE_NULL,
 		PARSE_STATE_ITEM,
@@ -172,7 +172,8 @@ void parse_data() {
 		printf("FIXTURE_CLUTTER initialized to bad value\n");
 		exit(1);
 	}
-	FIXTURE_CLUTTER->name = "clutter";
+	// in name_buf like every other name, so snapshots can save it as an offset
+	FIXTURE_CLUTTER->name = alloc_name("clutter", strlen("clutter"));
 	FIXTURE_CLUTTER->width = 2 * UNIT;
 	FIXTURE_CLUTTER->height = 2 * UNIT;
 	FIXTURE_CLUTTER->passable = true;
@@ -311,7 +312,15 @@ void parse_data() {
 			exit(1);
 		}
 	}
+}
 
+void parse_data() {
+	FILE* f = fopen("data.txt", "r");
+	if (f == NULL) {
+		printf("ERROR: Could not open data.txt\n");
+		exit(1);
+	}
+	parse_data_from(f);
 	fclose(f);
 }
 
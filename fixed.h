@@ -0,0 +1,124 @@
+#pragma once
+
+#include "util.h"
+
+// Fixed point square roots, in integer arithmetic only, so that they come
+// out the same on every machine and compiler, which state hashes and
+// replays depend on.
+//
+// The root itself is found by Newton's method. The input is shifted up by
+// an even number of bits so its top bit is bit 62 or 63, found by counting
+// leading zeroes, and its top byte then picks a pair of roots out of a
+// table to interpolate between, which is good to about 17 bits. Newton's
+// method doubles the good bits, so one step, and one divide, gets within
+// one of the answer and a last compare settles it, with no loops or
+// branches on the value.
+
+#if defined(__GNUC__) && !defined(__TINYC__)
+// x can't be 0
+int fx_clz64(uint64_t x) {
+	return __builtin_clzll(x);
+}
+#else
+// tcc has no builtin, so this halves the range each step instead
+int fx_clz64(uint64_t x) {
+	int n = 0;
+	int s;
+	s = (x >> 32 == 0) << 5; n += s; x <<= s;
+	s = (x >> 48 == 0) << 4; n += s; x <<= s;
+	s = (x >> 56 == 0) << 3; n += s; x <<= s;
+	s = (x >> 60 == 0) << 2; n += s; x <<= s;
+	s = (x >> 62 == 0) << 1; n += s; x <<= s;
+	n += x >> 63 == 0;
+	return n;
+}
+#endif
+
+// sqrt(k << 56) / 2 for k from 64 to 256, the roots at the ends of the
+// ranges each top byte covers
+const uint32_t fx_sqrt_seed[193] = {
+	1073741824, 1082097918, 1090389977, 1098619452, 1106787739, 1114896182, 1122946079, 1130938678,
+	1138875187, 1146756771, 1154584553, 1162359621, 1170083026, 1177755783, 1185378878, 1192953261,
+	1200479854, 1207959552, 1215393219, 1222781696, 1230125796, 1237426310, 1244684005, 1251899625,
+	1259073893, 1266207514, 1273301169, 1280355523, 1287371222, 1294348895, 1301289153, 1308192592,
+	1315059792, 1321891318, 1328687719, 1335449532, 1342177280, 1348871473, 1355532607, 1362161168,
+	1368757628, 1375322451, 1381856086, 1388358974, 1394831545, 1401274219, 1407687407, 1414071510,
+	1420426919, 1426754019, 1433053185, 1439324782, 1445569171, 1451786701, 1457977717, 1464142555,
+	1470281545, 1476395008, 1482483261, 1488546612, 1494585366, 1500599818, 1506590260, 1512556978,
+	1518500250, 1524420351, 1530317551, 1536192112, 1542044294, 1547874349, 1553682529, 1559469076,
+	1565234231, 1570978229, 1576701302, 1582403676, 1588085574, 1593747216, 1599388817, 1605010588,
+	1610612736, 1616195466, 1621758978, 1627303469, 1632829134, 1638336161, 1643824740, 1649295054,
+	1654747284, 1660181608, 1665598202, 1670997238, 1676378885, 1681743312, 1687090681, 1692421154,
+	1697734891, 1703032049, 1708312781, 1713577240, 1718825574, 1724057932, 1729274458, 1734475296,
+	1739660585, 1744830464, 1749985070, 1755124538, 1760249000, 1765358587, 1770453428, 1775533649,
+	1780599376, 1785650732, 1790687838, 1795710816, 1800719782, 1805714853, 1810696145, 1815663770,
+	1820617842, 1825558469, 1830485761, 1835399826, 1840300769, 1845188694, 1850063706, 1854925906,
+	1859775393, 1864612269, 1869436629, 1874248572, 1879048192, 1883835584, 1888610840, 1893374053,
+	1898125312, 1902864709, 1907592330, 1912308264, 1917012597, 1921705413, 1926386797, 1931056833,
+	1935715602, 1940363185, 1944999662, 1949625114, 1954239618, 1958843251, 1963436090, 1968018211,
+	1972589688, 1977150595, 1981701005, 1986240991, 1990770623, 1995289972, 1999799107, 2004298098,
+	2008787014, 2013265920, 2017734884, 2022193972, 2026643249, 2031082780, 2035512628, 2039932856,
+	2044343526, 2048744702, 2053136442, 2057518809, 2061891861, 2066255659, 2070610259, 2074955721,
+	2079292101, 2083619457, 2087937844, 2092247318, 2096547933, 2100839745, 2105122807, 2109397173,
+	2113662894, 2117920024, 2122168614, 2126408716, 2130640379, 2134863654, 2139078592, 2143285240,
+	2147483648,
+};
+
+// floor(sqrt(m)) for m with its top bit at 62 or 63, so the root is in
+// [2^31, 2^32)
+uint64_t fx_sqrt_top(uint64_t m) {
+	// along the chord between the roots either side, by the next 24 bits
+	size_t k = (m >> 56) - 64;
+	uint64_t along = m >> 32 & 0xffffff;
+	uint64_t y = (fx_sqrt_seed[k]
+		+ ((fx_sqrt_seed[k + 1] - fx_sqrt_seed[k]) * along >> 24)) << 1;
+	y = (y + m / y) >> 1;
+	// y is the root or one over it now, and has to stay under 2^32 for
+	// its square to fit
+	y = min(y, 0xffffffffULL);
+	return y - (y * y > m);
+}
+
+// floor(sqrt(x)), exactly
+uint32_t fx_isqrt(uint64_t x) {
+	// 0 goes through as 1 and is masked off after
+	int half = fx_clz64(x | 1) >> 1;
+	uint64_t y = fx_sqrt_top((x | (x == 0)) << 2 * half) >> half;
+	return y & -(uint64_t)(x != 0);
+}
+
+// 1/sqrt(x) with x and the result both fixed point, UNIT being one, so
+// UNIT * UNIT / sqrt(x * UNIT), rounded down, to within one. As with the
+// invsqrt_nr it replaces, x of 0 or less is taken as 1.
+num fx_invsqrt(num x) {
+	x = max(x, 1);
+	int half = fx_clz64(x) >> 1;
+	// that is 2^24 / sqrt(x), and this is sqrt(x) << half
+	uint64_t y = fx_sqrt_top((uint64_t)x << 2 * half);
+	return ((uint64_t)1 << (24 + half)) / y;
+}
+
+// floor(sqrt(x*x + y*y)), the length of x, y in the same units. Exact for
+// anything under 2^31 across, which is every difference between two points
+// in the world, since DIM is at most 2^30. Longer ones lose the bits past
+// that before squaring.
+num fx_hypot(num x, num y) {
+	uint64_t ux = x < 0 ? -(uint64_t)x : (uint64_t)x;
+	uint64_t uy = y < 0 ? -(uint64_t)y : (uint64_t)y;
+	int s = 33 - fx_clz64(ux | uy | 1);
+	s &= ~(s >> 31);
+	ux >>= s;
+	uy >>= s;
+	return (num)fx_isqrt(ux * ux + uy * uy) << s;
+}
+
+// out[k] = fx_hypot(dx[k], dy[k]) for every k, for callers that have a lot
+// of lengths to find at once. It is only a loop over fx_hypot, with nothing
+// batched: no one length depends on the last, so their divides overlap in
+// any such loop, and this runs at the same speed as one that stores each
+// result, see bench fixed.
+void fx_hypot_batch(const num *dx, const num *dy, num *out, size_t count) {
+	range (k, count) {
+		out[k] = fx_hypot(dx[k], dy[k]);
+	}
+}
@@ -0,0 +1,126 @@
+// Runs the simulation without creating a window or a Vulkan device, as fast
+// as it will go, and reports how long each frame took. Useful on machines
+// with no display, and as a number to track the hot paths of simulate()
+// against.
+
+#define FRAMERATE 60
+
+#include "data.h"
+#include "sim.h"
+#include "snapshot.h"
+#include "replay.h"
+
+int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+void usage(char *name) {
+	printf("usage: %s [--frames N] [--seed S] [--chars N] [--threads N]\n\t[--route-cache-mb N] [--idim N]\n\t[--fixture-order dense|sorted]\n\t[--load FILE] [--save FILE] [--checkpoint FILE --checkpoint-every N]\n\t[--record FILE] [--record-hash-every N] [--replay FILE]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	long frames = 0;
+	char *save_path = NULL;
+	world_seed = time(NULL);
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frames = atol(argv[++i]);
+		} else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+			save_path = argv[++i];
+		} else if (!sim_option(argc, argv, &i) && !snapshot_option(argc, argv, &i)
+			&& !replay_option(argc, argv, &i)
+		) {
+			usage(argv[0]);
+		}
+	}
+	if ((record_path != NULL || replay_path != NULL) && snapshot_load_path != NULL) {
+		printf("ERROR: Recording and replaying have to start from a new world, not --load\n");
+		exit(1);
+	}
+
+	uint64_t init_start = now_ns();
+	if (snapshot_load_path != NULL) {
+		snapshot_load(snapshot_load_path);
+	} else {
+		if (replay_path != NULL) {
+			// the world options come from the log, and so does the length
+			// of the run unless --frames cuts it short
+			replay_start(replay_path);
+			if (frames == 0) {
+				frames = replay_end_frame;
+			}
+		} else if (record_path != NULL) {
+			record_start(record_path);
+		} else {
+			parse_data();
+		}
+		printf("Seed %lu\n", world_seed);
+		printf("Total of %lu item types\n", item_type_count);
+		init_start = now_ns();
+		init();
+	}
+	uint64_t init_ns = now_ns() - init_start;
+	replay_frame_done();
+	if (frames == 0) {
+		frames = 60 * FRAMERATE;
+	}
+	if (frames < 0) {
+		usage(argv[0]);
+	}
+
+	uint64_t *frame_ns = malloc(frames * sizeof(uint64_t));
+	if (!frame_ns) {
+		printf("Could not allocate frame timings\n");
+		exit(1);
+	}
+
+	uint64_t run_start = now_ns();
+	range (i, frames) {
+		uint64_t start = now_ns();
+
+		frame++;
+		simulate();
+		snapshot_frame_done();
+
+		frame_ns[i] = now_ns() - start;
+		replay_frame_done();
+		if (frame % 600 == 0) {
+			printf("reached frame %d (%.2f seconds)\n", frame,
+				(double)(now_ns() - run_start) / 1e9);
+			STAT_SUMMARY();
+		}
+	}
+	uint64_t run_ns = now_ns() - run_start;
+	snapshot_checkpoint_reap(true);
+	if (save_path != NULL) {
+		snapshot_save(save_path);
+	}
+	record_finish();
+
+	qsort(frame_ns, frames, sizeof(uint64_t), cmp_u64);
+	uint64_t p50 = frame_ns[frames / 2];
+	uint64_t p99 = frame_ns[frames * 99 / 100];
+	uint64_t worst = frame_ns[frames - 1];
+
+	printf("%s: %.3f ms\n", snapshot_load_path ? "load" : "init", (double)init_ns / 1e6);
+	printf("%ld frames in %.3f s, %.1f frames per second\n",
+		frames, (double)run_ns / 1e9, (double)frames * 1e9 / (double)run_ns);
+	printf("frame time: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+		(double)p50 / 1e6, (double)p99 / 1e6, (double)worst / 1e6);
+	printf("entities: %lu characters, %lu fixtures, %lu obstacles, %lu nav nodes\n",
+		char_count, fixture_count, obstacle_count, nav_node_count);
+	route_cache_print_stats();
+	path_arena_print_stats();
+	printf("state hash: %016lx\n", sim_hash());
+	if (replaying) {
+		printf("replay: matched %lu recorded hashes through frame %d\n",
+			replay_hashes_checked, frame);
+	}
+	STAT_PRINT_RUN();
+
+	free(frame_ns);
+	return 0;
+}
@@ -0,0 +1,7 @@
+#!/bin/sh
+# pass -DSIM_STATS in CFLAGS for per-phase timings, e.g. the crowded world
+# benchmark is
+#   CFLAGS='-DSIM_STATS' ./headless.sh --idim 256 --chars 12000 --frames 600 --seed 1
+# and a run recorded with --record FILE can be timed again on another build,
+# and checked against it as it goes, with --replay FILE
+cc -O2 -march=native $CFLAGS headless.c -o headless -DNDEBUG -lpthread && ./headless "$@"
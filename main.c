@@ -4,6 +4,8 @@
 
 #include "data.h"
 #include "sim.h"
+#include "snapshot.h"
+#include "replay.h"
 
 #include <time.h>
 
@@ -79,7 +81,7 @@ void line_by_num(
 	num dx = x1_num - x0_num;
 	num dy = y1_num - y0_num;
 	num qu = (dx*dx + dy*dy)/UNIT;
-	num scale = invsqrt_nr(qu);
+	num scale = fx_invsqrt(qu);
 	num vx_num = dy*scale/UNIT;
 	num vy_num = -dx*scale/UNIT;
 	float vx = thickness * (float)vx_num / (float)DIM;
@@ -135,8 +137,8 @@ size_t build_vertex_data(struct Vertex* vertex_data) {
 	}
 	float dx = 0.95f/100.0f;
 	range (i, char_count) {
-		float x = (float)chars[i].x / (float)DIM;
-		float y = -(float)chars[i].y / (float)DIM;
+		float x = (float)chars.x[i] / (float)DIM;
+		float y = -(float)chars.y[i] / (float)DIM;
 
 		float col[3] = {0.5f, 0.5f, 0.5f};
 		bright((float)(i % 12)*0.5f, col);
@@ -162,8 +164,8 @@ size_t build_vertex_data(struct Vertex* vertex_data) {
 	}
 	/*
 	range (i, nav_node_count) {
-		range (j0, nav_adj_counts[i]) {
-			size_t j = nav_adj[i][j0].it.i;
+		for (uint32_t e = nav_edge_start[i]; e < nav_edge_start[i + 1]; e++) {
+			size_t j = nav_edge_to[e];
 			if (i < j) {
 				line_by_num(
 					vertex_data, &total,
@@ -184,8 +186,6 @@ void recordResize(GLFWwindow *window, int width, int height) {
 	*recreateGraphics = true;
 }
 
-const num MOUSE_RANGE = DIM_CTIME / 32;
-
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
 	double glfw_x;
 	double glfw_y;
@@ -196,21 +196,40 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 	num x = 2 * DIM * (num)glfw_x / width - DIM;
 	num y = 2 * DIM * (num)glfw_y / height - DIM;
 	if (action == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_LEFT) {
-		ref nearest = find_nearest(x, y, MOUSE_RANGE, is_char);
-		if (nearest != -1) {
-			selected_char = nearest & REF_IND;
-		} else {
-			selected_char = -1;
-		}
+		selected_char = select_char(x, y);
 	} else if (action == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_RIGHT) {
 	}
 }
 
-int main() {
-	srand(time(&start_time));
-
-	parse_data();
-	printf("Total of %lu item types\n", item_type_count);
+int main(int argc, char **argv) {
+	world_seed = time(&start_time);
+	for (int i = 1; i < argc; i++) {
+		if (!sim_option(argc, argv, &i) && !snapshot_option(argc, argv, &i)
+			&& !replay_option(argc, argv, &i)
+		) {
+			printf("usage: %s [--seed S] [--chars N] [--threads N] [--route-cache-mb N]\n\t[--idim N] [--fixture-order dense|sorted]\n\t[--load FILE] [--checkpoint FILE --checkpoint-every N]\n\t[--record FILE] [--record-hash-every N]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (replay_path != NULL) {
+		printf("ERROR: Replays run in headless\n");
+		exit(1);
+	}
+	if (record_path != NULL && snapshot_load_path != NULL) {
+		printf("ERROR: Recording has to start from a new world, not --load\n");
+		exit(1);
+	}
+	if (snapshot_load_path != NULL) {
+		snapshot_load(snapshot_load_path);
+	} else {
+		printf("Seed %lu\n", world_seed);
+		if (record_path != NULL) {
+			record_start(record_path);
+		} else {
+			parse_data();
+		}
+		printf("Total of %lu item types\n", item_type_count);
+	}
 
 	struct GraphicsInstance gi = createGraphicsInstance();
 	struct Graphics g = createGraphics(&gi);
@@ -220,7 +239,10 @@ int main() {
 	glfwSetFramebufferSizeCallback(gi.window, recordResize);
 	glfwSetMouseButtonCallback(gi.window, mouse_button_callback);
 
-	init();
+	if (snapshot_load_path == NULL) {
+		init();
+	}
+	replay_frame_done();
 
 	while(!glfwWindowShouldClose(gi.window)) {
 		glfwPollEvents();
@@ -228,9 +250,12 @@ int main() {
 		frame++;
 		if (frame % 600 == 0) {
 			printf("reached frame %d (%d seconds)\n", frame, time(NULL)-start_time);
+			STAT_SUMMARY();
 		}
 
 		simulate();
+		snapshot_frame_done();
+		replay_frame_done();
 
 		if (recreateGraphics || !drawFrame(&gi, &g)) {
 			int width;
@@ -249,6 +274,8 @@ int main() {
 
 	destroyGraphics(&gi, &g);
 	destroyGraphicsInstance(&gi);
+	snapshot_checkpoint_reap(true);
+	record_finish();
 
 	return 0;
 }
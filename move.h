@@ -0,0 +1,167 @@
+#pragma once
+
+#include "util.h"
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+// Movement kernel: integrates x += vx, y += vy for n characters, clamps the
+// result to [lo, hi], and lists the characters whose chunk changed, so that
+// only those need their chunk membership updated afterwards. Chunks are
+// (pos + offset) >> shift, which is why chunk sizes are powers of two.
+//
+// crossed[k] gets the index of the k-th character to change chunk, and
+// from_cx[k], from_cy[k] the chunk it was in before moving. Returns the
+// number of crossings.
+//
+// Built with AVX2 this moves 4 characters per instruction, with SSE4.2 2,
+// otherwise it falls back to the scalar loop, which all of them also use for
+// the leftover tail.
+
+size_t move_kernel_scalar(
+	num *xs, num *ys, const num *vxs, const num *vys,
+	size_t start, size_t n,
+	num lo, num hi, num offset, int shift,
+	uint32_t *crossed, uint32_t *from_cx, uint32_t *from_cy
+) {
+	size_t count = 0;
+	for (size_t i = start; i < n; i++) {
+		num x = xs[i];
+		num y = ys[i];
+		num newx = x + vxs[i];
+		num newy = y + vys[i];
+		newx = newx > hi ? hi : newx < lo ? lo : newx;
+		newy = newy > hi ? hi : newy < lo ? lo : newy;
+		xs[i] = newx;
+		ys[i] = newy;
+		uint32_t cx = (uint32_t)((x + offset) >> shift);
+		uint32_t cy = (uint32_t)((y + offset) >> shift);
+		if (cx != (uint32_t)((newx + offset) >> shift)
+			|| cy != (uint32_t)((newy + offset) >> shift)
+		) {
+			crossed[count] = i;
+			from_cx[count] = cx;
+			from_cy[count] = cy;
+			count += 1;
+		}
+	}
+	return count;
+}
+
+#if defined(__AVX2__)
+
+size_t move_kernel(
+	num *xs, num *ys, const num *vxs, const num *vys, size_t n,
+	num lo, num hi, num offset, int shift,
+	uint32_t *crossed, uint32_t *from_cx, uint32_t *from_cy
+) {
+	const __m256i vlo = _mm256_set1_epi64x(lo);
+	const __m256i vhi = _mm256_set1_epi64x(hi);
+	const __m256i voff = _mm256_set1_epi64x(offset);
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)&xs[i]);
+		__m256i y = _mm256_loadu_si256((const __m256i*)&ys[i]);
+		__m256i newx = _mm256_add_epi64(x,
+			_mm256_loadu_si256((const __m256i*)&vxs[i]));
+		__m256i newy = _mm256_add_epi64(y,
+			_mm256_loadu_si256((const __m256i*)&vys[i]));
+
+		// no 64 bit min/max before AVX-512, so compare and blend
+		newx = _mm256_blendv_epi8(newx, vhi, _mm256_cmpgt_epi64(newx, vhi));
+		newx = _mm256_blendv_epi8(newx, vlo, _mm256_cmpgt_epi64(vlo, newx));
+		newy = _mm256_blendv_epi8(newy, vhi, _mm256_cmpgt_epi64(newy, vhi));
+		newy = _mm256_blendv_epi8(newy, vlo, _mm256_cmpgt_epi64(vlo, newy));
+		_mm256_storeu_si256((__m256i*)&xs[i], newx);
+		_mm256_storeu_si256((__m256i*)&ys[i], newy);
+
+		// positions are never below -offset, so a logical shift is fine
+		__m256i cx = _mm256_srli_epi64(_mm256_add_epi64(x, voff), shift);
+		__m256i cy = _mm256_srli_epi64(_mm256_add_epi64(y, voff), shift);
+		__m256i same = _mm256_and_si256(
+			_mm256_cmpeq_epi64(cx, _mm256_srli_epi64(_mm256_add_epi64(newx, voff), shift)),
+			_mm256_cmpeq_epi64(cy, _mm256_srli_epi64(_mm256_add_epi64(newy, voff), shift))
+		);
+		int moved = ~_mm256_movemask_pd(_mm256_castsi256_pd(same)) & 0xF;
+		if (moved) {
+			uint64_t old_cx[4], old_cy[4];
+			_mm256_storeu_si256((__m256i*)old_cx, cx);
+			_mm256_storeu_si256((__m256i*)old_cy, cy);
+			range (lane, 4) {
+				if (moved & (1 << lane)) {
+					crossed[count] = i + lane;
+					from_cx[count] = old_cx[lane];
+					from_cy[count] = old_cy[lane];
+					count += 1;
+				}
+			}
+		}
+	}
+	return count + move_kernel_scalar(xs, ys, vxs, vys, i, n, lo, hi,
+		offset, shift, crossed + count, from_cx + count, from_cy + count);
+}
+
+#elif defined(__SSE4_2__)
+
+size_t move_kernel(
+	num *xs, num *ys, const num *vxs, const num *vys, size_t n,
+	num lo, num hi, num offset, int shift,
+	uint32_t *crossed, uint32_t *from_cx, uint32_t *from_cy
+) {
+	const __m128i vlo = _mm_set1_epi64x(lo);
+	const __m128i vhi = _mm_set1_epi64x(hi);
+	const __m128i voff = _mm_set1_epi64x(offset);
+	size_t count = 0;
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) {
+		__m128i x = _mm_loadu_si128((const __m128i*)&xs[i]);
+		__m128i y = _mm_loadu_si128((const __m128i*)&ys[i]);
+		__m128i newx = _mm_add_epi64(x, _mm_loadu_si128((const __m128i*)&vxs[i]));
+		__m128i newy = _mm_add_epi64(y, _mm_loadu_si128((const __m128i*)&vys[i]));
+
+		newx = _mm_blendv_epi8(newx, vhi, _mm_cmpgt_epi64(newx, vhi));
+		newx = _mm_blendv_epi8(newx, vlo, _mm_cmpgt_epi64(vlo, newx));
+		newy = _mm_blendv_epi8(newy, vhi, _mm_cmpgt_epi64(newy, vhi));
+		newy = _mm_blendv_epi8(newy, vlo, _mm_cmpgt_epi64(vlo, newy));
+		_mm_storeu_si128((__m128i*)&xs[i], newx);
+		_mm_storeu_si128((__m128i*)&ys[i], newy);
+
+		__m128i cx = _mm_srli_epi64(_mm_add_epi64(x, voff), shift);
+		__m128i cy = _mm_srli_epi64(_mm_add_epi64(y, voff), shift);
+		__m128i same = _mm_and_si128(
+			_mm_cmpeq_epi64(cx, _mm_srli_epi64(_mm_add_epi64(newx, voff), shift)),
+			_mm_cmpeq_epi64(cy, _mm_srli_epi64(_mm_add_epi64(newy, voff), shift))
+		);
+		int moved = ~_mm_movemask_pd(_mm_castsi128_pd(same)) & 0x3;
+		if (moved) {
+			uint64_t old_cx[2], old_cy[2];
+			_mm_storeu_si128((__m128i*)old_cx, cx);
+			_mm_storeu_si128((__m128i*)old_cy, cy);
+			range (lane, 2) {
+				if (moved & (1 << lane)) {
+					crossed[count] = i + lane;
+					from_cx[count] = old_cx[lane];
+					from_cy[count] = old_cy[lane];
+					count += 1;
+				}
+			}
+		}
+	}
+	return count + move_kernel_scalar(xs, ys, vxs, vys, i, n, lo, hi,
+		offset, shift, crossed + count, from_cx + count, from_cy + count);
+}
+
+#else
+
+size_t move_kernel(
+	num *xs, num *ys, const num *vxs, const num *vys, size_t n,
+	num lo, num hi, num offset, int shift,
+	uint32_t *crossed, uint32_t *from_cx, uint32_t *from_cy
+) {
+	return move_kernel_scalar(xs, ys, vxs, vys, 0, n, lo, hi, offset, shift,
+		crossed, from_cx, from_cy);
+}
+
+#endif
@@ -1,8 +1,13 @@
 #pragma once
 
 #include "util.h"
+#include "fixed.h"
+#include "stats.h"
+#include "obstruct.h"
 
+#ifndef OBSTACLE_CAP
 #define OBSTACLE_CAP 256
+#endif
 struct Obstacle {
 	num l,r,t,b; // l < r && b < t
 } obstacles[OBSTACLE_CAP];
@@ -11,90 +16,368 @@ typedef struct Obstacle *Obstacle;
 
 typedef struct nav { size_t i; } nav;
 
+#ifndef NAV_NODE_CAP
 #define NAV_NODE_CAP (OBSTACLE_CAP * 4)
+#endif
 struct NavNode {
 	num x, y;
 } nav_nodes[NAV_NODE_CAP];
 size_t nav_node_count = 0;
 
-size_t nav_adj_counts[NAV_NODE_CAP];
-struct NavAdj {
-	nav it;
-	num dist;
-} nav_adj[NAV_NODE_CAP][NAV_NODE_CAP];
+// The nav graph as compressed sparse rows: the edges out of node i go to
+// nav_edge_to[e] at a distance of nav_edge_dist[e], rounded up, for e from
+// nav_edge_start[i] up to nav_edge_start[i + 1], in node order. Edges are
+// listed both ways round, so nav_edge_count is twice the number of lines.
+uint32_t nav_edge_start[NAV_NODE_CAP + 1];
+uint32_t *nav_edge_to;
+num *nav_edge_dist;
+size_t nav_edge_count = 0;
 
-bool interval_obstructed(
+// edges found by the builders, as pairs of nodes, until nav_finish_edges
+// packs them into rows
+struct NavPair {
+	uint32_t i, j;
+} *nav_pairs;
+size_t nav_pair_count = 0;
+size_t nav_pair_cap = 0;
+
+bool obstacle_blocks(
+	struct Obstacle *o, num x0, num y0, num x1, num y1
+) {
+	num l = o->l;
+	num r = o->r;
+	num b = o->b;
+	num t = o->t;
+
+	// If line doesnt touch polygon, then interval doesnt touch polygon on
+	// the other hand if line touches polygon then its intersection with
+	// the polygon will be another interval, specifically the intersection
+	// of two half planes with the line
+	// if the actual interval doesn't touch this intersection area then it
+	// must be fully outside one of the half planes
+	//
+	// this lets us separate the test into two completely separate parts,
+	// one based on the interval sitting outside any half plane, and the
+	// other based on whether its extension to a line passes through the
+	// polygon
+	if (x0 <= l && x1 <= l) { return false; }
+	if (x0 >= r && x1 >= r) { return false; }
+	if (y0 <= b && y1 <= b) { return false; }
+	if (y0 >= t && y1 >= t) { return false; }
+
+	num dx = x1 - x0;
+	num dy = y1 - y0;
+
+	if (dx == 0 || dy == 0) {
+		// the previous test is sufficient for axis aligned intervals
+		return true;
+	}
+
+	// recall points on line will satisfy
+	// (x - x0)(y1 - y0) = (y - y0)(x1 - x0)
+	// avoid expanding brackets, to prevent overflow
+	// x = x0 + (y - y0)(x1 - x0)/(y1 - y0)
+	// y = y0 + (x - x0)(y1 - y0)/(x1 - x0)
+	num bx = x0 + (b - y0)*dx/dy;
+	num tx = x0 + (t - y0)*dx/dy;
+	num ly = y0 + (l - x0)*dy/dx;
+	num ry = y0 + (r - x0)*dy/dx;
+
+	// a positive gradient line will miss the rectangle if and only if it
+	// passes through the rays extending from either the top left or bottom
+	// right corner
+	// we test for these miss regions because that way we leave no place to
+	// squeak through, whereas if we test the edges of the rectangle
+	// directly then the corner of the rectangle becomes difficult to
+	// detect
+	if (dx * dy > 0) {
+		return !((ly >= t && tx <= l) || (ry <= b && bx >= r));
+	} else {
+		return !((ry >= t && tx >= r) || (ly <= b && bx <= l));
+	}
+}
+
+// Every obstacle in turn. Kept as the reference for obstacle_grid, see
+// bench obstruct.
+bool interval_obstructed_linear(
 	num x0, num y0, num x1, num y1
 ) {
 	range(o, obstacle_count) {
-		num l = obstacles[o].l;
-		num r = obstacles[o].r;
-		num b = obstacles[o].b;
-		num t = obstacles[o].t;
-
-		// If line doesnt touch polygon, then interval doesnt touch polygon on
-		// the other hand if line touches polygon then its intersection with
-		// the polygon will be another interval, specifically the intersection
-		// of two half planes with the line
-		// if the actual interval doesn't touch this intersection area then it
-		// must be fully outside one of the half planes
-		//
-		// this lets us separate the test into two completely separate parts,
-		// one based on the interval sitting outside any half plane, and the
-		// other based on whether its extension to a line passes through the
-		// polygon
-		if (x0 <= l && x1 <= l) { continue; }
-		if (x0 >= r && x1 >= r) { continue; }
-		if (y0 <= b && y1 <= b) { continue; }
-		if (y0 >= t && y1 >= t) { continue; }
-
-		num dx = x1 - x0;
-		num dy = y1 - y0;
-
-		if (dx == 0 || dy == 0) {
-			// the previous test is sufficient for axis aligned intervals
+		if (obstacle_blocks(&obstacles[o], x0, y0, x1, y1)) {
 			return true;
 		}
+	}
+	return false;
+}
 
-		// recall points on line will satisfy
-		// (x - x0)(y1 - y0) = (y - y0)(x1 - x0)
-		// avoid expanding brackets, to prevent overflow
-		// x = x0 + (y - y0)(x1 - x0)/(y1 - y0)
-		// y = y0 + (x - x0)(y1 - y0)/(x1 - x0)
-		num bx = x0 + (b - y0)*dx/dy;
-		num tx = x0 + (t - y0)*dx/dy;
-		num ly = y0 + (l - x0)*dy/dx;
-		num ry = y0 + (r - x0)*dy/dx;
-
-		// a positive gradient line will miss the rectangle if and only if it
-		// passes through the rays extending from either the top left or bottom
-		// right corner
-		// we test for these miss regions because that way we leave no place to
-		// squeak through, whereas if we test the edges of the rectangle
-		// directly then the corner of the rectangle becomes difficult to
-		// detect
-		if (dx * dy > 0) {
-			if ((ly >= t && tx <= l) || (ry <= b && bx >= r)) {
-				continue;
+// obstacle_blocks rounds its intercepts, so it can call a line blocked when
+// it passes within a unit of a corner. Anything that only wants to test the
+// obstacles near a line has to grow them by this much to be sure it tests
+// every obstacle that obstacle_blocks would say blocks it.
+#define OBSTACLE_MARGIN 2
+
+// Uniform grid over the obstacles, each listed in every cell its rectangle
+// grown by OBSTACLE_MARGIN overlaps, so that interval_obstructed only has
+// to test the obstacles in the cells a segment passes through. Built by
+// build_obstacle_grid whenever the obstacles change.
+struct ObstacleGrid {
+	num l, b; // bottom left corner of cell 0, 0
+	num cell_size;
+	long cols, rows;
+	size_t obstacle_count; // what it was built for
+	// obstacles in cell (c, r) are items[cell_start[r*cols + c]] up to
+	// items[cell_start[r*cols + c + 1]]
+	uint32_t *cell_start;
+	uint32_t *items;
+	// copies of each listed obstacle's bounds, for obstruct_lanes, padded
+	// so a full set of lanes can always be loaded
+	num *l_of, *r_of, *b_of, *t_of;
+	bool within_limit; // every obstacle is under OBSTRUCT_COORD_LIMIT
+} obstacle_grid;
+
+// which cells each obstacle is listed in
+struct ObstacleCells {
+	long l, r, b, t;
+} obstacle_cells[OBSTACLE_CAP];
+
+long obstacle_grid_col(num x) {
+	struct ObstacleGrid *g = &obstacle_grid;
+	return x < g->l ? -1 : min((x - g->l) / g->cell_size, g->cols);
+}
+
+long obstacle_grid_row(num y) {
+	struct ObstacleGrid *g = &obstacle_grid;
+	return y < g->b ? -1 : min((y - g->b) / g->cell_size, g->rows);
+}
+
+void build_obstacle_grid(void) {
+	struct ObstacleGrid *g = &obstacle_grid;
+	free(g->cell_start);
+	free(g->items);
+	free(g->l_of);
+	free(g->r_of);
+	free(g->b_of);
+	free(g->t_of);
+	g->obstacle_count = obstacle_count;
+	g->within_limit = true;
+	g->cols = 1;
+	g->rows = 1;
+	g->l = 0;
+	g->b = 0;
+	g->cell_size = 1;
+	if (obstacle_count > 0) {
+		num l = NUM_GREATEST, r = -NUM_GREATEST;
+		num b = NUM_GREATEST, t = -NUM_GREATEST;
+		range(o, obstacle_count) {
+			l = min(l, obstacles[o].l - OBSTACLE_MARGIN);
+			r = max(r, obstacles[o].r + OBSTACLE_MARGIN);
+			b = min(b, obstacles[o].b - OBSTACLE_MARGIN);
+			t = max(t, obstacles[o].t + OBSTACLE_MARGIN);
+		}
+		// about one cell per obstacle
+		// mid * mid * obstacle_count < area, without the product, which
+		// overflows on big worlds
+		num area = (r - l) * (t - b);
+		num per_obstacle = (area - 1) / (num)obstacle_count;
+		num lo = 1, hi = max(r - l, t - b);
+		while (lo < hi) {
+			num mid = lo + (hi - lo) / 2;
+			if (mid <= per_obstacle / mid) {
+				lo = mid + 1;
 			} else {
-				return true;
+				hi = mid;
+			}
+		}
+		num size = lo;
+		g->l = l;
+		g->b = b;
+		g->cell_size = size;
+		g->cols = (r - l) / size + 1;
+		g->rows = (t - b) / size + 1;
+	}
+
+	size_t cell_count = g->cols * g->rows;
+	g->cell_start = calloc(cell_count + 1, sizeof(uint32_t));
+	range(o, obstacle_count) {
+		struct ObstacleCells *c = &obstacle_cells[o];
+		c->l = obstacle_grid_col(obstacles[o].l - OBSTACLE_MARGIN);
+		c->r = obstacle_grid_col(obstacles[o].r + OBSTACLE_MARGIN);
+		c->b = obstacle_grid_row(obstacles[o].b - OBSTACLE_MARGIN);
+		c->t = obstacle_grid_row(obstacles[o].t + OBSTACLE_MARGIN);
+		for (long row = c->b; row <= c->t; row++) {
+			for (long col = c->l; col <= c->r; col++) {
+				g->cell_start[row * g->cols + col + 1] += 1;
+			}
+		}
+	}
+	range(i, cell_count) {
+		g->cell_start[i + 1] += g->cell_start[i];
+	}
+	size_t listings = g->cell_start[cell_count] + OBSTRUCT_LANES - 1;
+	g->items = malloc(listings * sizeof(uint32_t));
+	g->l_of = malloc(listings * sizeof(num));
+	g->r_of = malloc(listings * sizeof(num));
+	g->b_of = malloc(listings * sizeof(num));
+	g->t_of = malloc(listings * sizeof(num));
+	uint32_t *fill = malloc(cell_count * sizeof(uint32_t));
+	memcpy(fill, g->cell_start, cell_count * sizeof(uint32_t));
+	range(o, obstacle_count) {
+		struct ObstacleCells *c = &obstacle_cells[o];
+		for (long row = c->b; row <= c->t; row++) {
+			for (long col = c->l; col <= c->r; col++) {
+				g->items[fill[row * g->cols + col]++] = o;
 			}
+		}
+		g->within_limit = g->within_limit
+			&& obstruct_within_limit(obstacles[o].l, obstacles[o].b)
+			&& obstruct_within_limit(obstacles[o].r, obstacles[o].t);
+	}
+	free(fill);
+	range(k, listings) {
+		if (k < g->cell_start[cell_count]) {
+			struct Obstacle *o = &obstacles[g->items[k]];
+			g->l_of[k] = o->l;
+			g->r_of[k] = o->r;
+			g->b_of[k] = o->b;
+			g->t_of[k] = o->t;
 		} else {
-			if ((ry >= t && tx >= r) || (ly <= b && bx <= l)) {
+			// never blocks anything
+			g->items[k] = 0;
+			g->l_of[k] = NUM_GREATEST;
+			g->r_of[k] = NUM_GREATEST;
+			g->b_of[k] = NUM_GREATEST;
+			g->t_of[k] = NUM_GREATEST;
+		}
+	}
+}
+
+// Walks the grid a column at a time, left to right, testing the obstacles
+// in every cell of the column that the segment could pass through, and
+// returns the first one found to block it, or -1.
+//
+// With obstruct_lanes testing several listings at once, a block of lanes
+// can run on into the next cell, or test an obstacle twice, but that only
+// costs time: any obstacle that blocks the segment is a right answer.
+// Testing one at a time, an obstacle listed in several cells is only tested
+// in the first one. The rows visited in each column only ever move one way,
+// so if an obstacle was in an earlier column's cells it was in the previous
+// column's cells, and that is all we need to check.
+long obstacle_grid_walk(const struct ObstructSegment *s) {
+	struct ObstacleGrid *g = &obstacle_grid;
+	num ax = s->x0, ay = s->y0, bx = s->x1, by = s->y1;
+	if (bx < ax) {
+		ax = s->x1; ay = s->y1;
+		bx = s->x0; by = s->y0;
+	}
+	long first_col = max(obstacle_grid_col(ax), 0);
+	long last_col = min(obstacle_grid_col(bx), g->cols - 1);
+#if OBSTRUCT_LANES == 1
+	long prev_b = 0, prev_t = -1;
+#endif
+	for (long col = first_col; col <= last_col; col++) {
+		num xl = max(ax, g->l + col * g->cell_size);
+		num xr = min(bx, g->l + (col + 1) * g->cell_size);
+		num yl = ay, yr = by;
+		if (bx != ax) {
+			yl = ay + (xl - ax) * (by - ay) / (bx - ax);
+			yr = ay + (xr - ax) * (by - ay) / (bx - ax);
+		}
+		// a unit either way for the rounding in yl and yr
+		long b = max(obstacle_grid_row(min(yl, yr) - 1), 0);
+		long t = min(obstacle_grid_row(max(yl, yr) + 1), g->rows - 1);
+		for (long row = b; row <= t; row++) {
+			uint32_t *cell = &g->cell_start[row * g->cols + col];
+			for (uint32_t k = cell[0]; k < cell[1]; k += OBSTRUCT_LANES) {
+#if OBSTRUCT_LANES == 1
+				struct ObstacleCells *c = &obstacle_cells[g->items[k]];
+				if (row > b && c->b < row) {
+					continue; // already tested lower in this column
+				}
+				if (col > first_col && c->l < col
+					&& c->b <= prev_t && prev_b <= c->t
+				) {
+					continue; // already tested in the previous column
+				}
+#endif
+				int mask = obstruct_lanes(s,
+					&g->l_of[k], &g->r_of[k], &g->b_of[k], &g->t_of[k]);
+				if (mask) {
+					int lane = 0;
+					while (!(mask & 1 << lane)) {
+						lane += 1;
+					}
+					return g->items[k + lane];
+				}
+			}
+		}
+#if OBSTRUCT_LANES == 1
+		prev_b = b;
+		prev_t = t;
+#endif
+	}
+	return -1;
+}
+
+bool obstacle_grid_usable(num x0, num y0, num x1, num y1) {
+	struct ObstacleGrid *g = &obstacle_grid;
+	return g->obstacle_count == obstacle_count && g->within_limit
+		&& obstruct_within_limit(x0, y0) && obstruct_within_limit(x1, y1);
+}
+
+bool interval_obstructed(
+	num x0, num y0, num x1, num y1
+) {
+	STAT_INC(interval_obstructed);
+	if (!obstacle_grid_usable(x0, y0, x1, y1)) {
+		return interval_obstructed_linear(x0, y0, x1, y1);
+	}
+	struct ObstructSegment s = obstruct_segment(x0, y0, x1, y1);
+	return obstacle_grid_walk(&s) >= 0;
+}
+
+// Many segments at once: clear[i] is whether the line from the point to nav
+// node i is clear, or from node i to the point if from_nodes is set, since
+// rounding makes the direction matter. The same as calling
+// interval_obstructed for each, but consecutive nodes are usually corners of
+// the same obstacle and so are often blocked by the same thing, so that
+// gets tried first.
+void nav_node_visibility(num px, num py, bool from_nodes, bool *clear) {
+	long last_blocker = -1;
+	range(i, nav_node_count) {
+		STAT_INC(interval_obstructed);
+		num x0 = px, y0 = py, x1 = nav_nodes[i].x, y1 = nav_nodes[i].y;
+		if (from_nodes) {
+			x0 = nav_nodes[i].x;
+			y0 = nav_nodes[i].y;
+			x1 = px;
+			y1 = py;
+		}
+		if (!obstacle_grid_usable(x0, y0, x1, y1)) {
+			clear[i] = !interval_obstructed_linear(x0, y0, x1, y1);
+			continue;
+		}
+		struct ObstructSegment s = obstruct_segment(x0, y0, x1, y1);
+		if (last_blocker >= 0) {
+			struct Obstacle *o = &obstacles[last_blocker];
+			if (obstruct_one(&s, o->l, o->r, o->b, o->t)) {
+				clear[i] = false;
 				continue;
-			} else {
-				return true;
 			}
 		}
+		long blocker = obstacle_grid_walk(&s);
+		clear[i] = blocker < 0;
+		if (blocker >= 0) {
+			last_blocker = blocker;
+		}
 	}
-	return false;
 }
 
-void initialize_nav_edges(num world_l, num world_r, num world_b, num world_t) {
+void initialize_nav_nodes(num world_l, num world_r, num world_b, num world_t) {
 	if (obstacle_count * 4 > NAV_NODE_CAP) {
 		printf("ERROR: Nav node capacity is too small\n");
 		exit(1);
 	}
+	build_obstacle_grid();
 	nav_node_count = 0;
 	range(i, obstacle_count) {
 		num l = obstacles[i].l;
@@ -108,127 +391,747 @@ void initialize_nav_edges(num world_l, num world_r, num world_b, num world_t) {
 			if (world_l < x && x < world_r && world_b < y && y < world_t) {
 				nav_nodes[nav_node_count].x = x;
 				nav_nodes[nav_node_count].y = y;
-				nav_adj_counts[nav_node_count] = 0;
 				nav_node_count += 1;
 			}
 		}
 	}
+}
 
+void nav_add_edge(size_t i, size_t j) {
+	if (nav_pair_count == nav_pair_cap) {
+		nav_pair_cap = max(2 * nav_pair_cap, 1024);
+		nav_pairs = realloc(nav_pairs, nav_pair_cap * sizeof(struct NavPair));
+		if (nav_pairs == NULL) {
+			printf("ERROR: Out of memory for nav edges\n");
+			exit(1);
+		}
+	}
+	nav_pairs[nav_pair_count] = (struct NavPair){i, j};
+	nav_pair_count += 1;
+}
+
+// Both builders add each node's edges to higher nodes in order, after all
+// of the edges from lower nodes to it, so placing the pairs in the order
+// they were added leaves every row sorted.
+void nav_finish_edges(void) {
+	nav_edge_count = 2 * nav_pair_count;
+	free(nav_edge_to);
+	free(nav_edge_dist);
+	nav_edge_to = malloc(max(nav_edge_count, 1) * sizeof(uint32_t));
+	nav_edge_dist = malloc(max(nav_edge_count, 1) * sizeof(num));
+	if (nav_edge_to == NULL || nav_edge_dist == NULL) {
+		printf("ERROR: Out of memory for nav edges\n");
+		exit(1);
+	}
+
+	memset(nav_edge_start, 0, (nav_node_count + 1) * sizeof(uint32_t));
+	range(k, nav_pair_count) {
+		nav_edge_start[nav_pairs[k].i + 1] += 1;
+		nav_edge_start[nav_pairs[k].j + 1] += 1;
+	}
+	range(i, nav_node_count) {
+		nav_edge_start[i + 1] += nav_edge_start[i];
+	}
+	uint32_t *fill = malloc(max(nav_node_count, 1) * sizeof(uint32_t));
+	if (fill == NULL) {
+		printf("ERROR: Out of memory for nav edges\n");
+		exit(1);
+	}
+	memcpy(fill, nav_edge_start, nav_node_count * sizeof(uint32_t));
+	range(k, nav_pair_count) {
+		uint32_t i = nav_pairs[k].i;
+		uint32_t j = nav_pairs[k].j;
+		num dx = nav_nodes[j].x - nav_nodes[i].x;
+		num dy = nav_nodes[j].y - nav_nodes[i].y;
+		num distance = fx_hypot(dx, dy);
+		// rounded up, see route_heuristic
+		distance += distance * distance < dx * dx + dy * dy;
+		nav_edge_to[fill[i]] = j;
+		nav_edge_dist[fill[i]] = distance;
+		fill[i] += 1;
+		nav_edge_to[fill[j]] = i;
+		nav_edge_dist[fill[j]] = distance;
+		fill[j] += 1;
+	}
+	free(fill);
+	nav_pair_count = 0;
+}
+
+// Every pair against every obstacle, O(N^2 M). Kept as the reference the
+// sweep below has to agree with, see bench navbuild.
+void build_nav_edges_brute_force(void) {
+	nav_pair_count = 0;
 	range(j, nav_node_count) {
 		range(i, j) {
-			if (!interval_obstructed(
+			if (!interval_obstructed_linear(
 				nav_nodes[i].x, nav_nodes[i].y, nav_nodes[j].x, nav_nodes[j].y
 			)) {
-				struct NavAdj *adj_ij = &nav_adj[i][nav_adj_counts[i]];
-				nav_adj_counts[i] += 1;
-				struct NavAdj *adj_ji = &nav_adj[j][nav_adj_counts[j]];
-				nav_adj_counts[j] += 1;
-				adj_ij->it.i = j;
-				adj_ji->it.i = i;
-				num distance = num_hypot(
-					nav_nodes[j].x - nav_nodes[i].x,
-					nav_nodes[j].y - nav_nodes[i].y
-				);
-				adj_ij->dist = distance;
-				adj_ji->dist = distance;
+				nav_add_edge(i, j);
 			}
 		}
 	}
+	nav_finish_edges();
+}
+
+// Rotational sweep: for each node, sort the other nodes and the ends of
+// each obstacle's angular extent by angle around it, then walk round once
+// keeping the set of obstacles whose extent covers the current direction.
+// Only those can block a line in that direction.
+//
+// Lee's algorithm keeps the active set in order of how far along the ray
+// each obstacle starts, and tests only the nearest. That needs obstacles
+// that don't overlap, and grown by the margin these do, so the order would
+// change as the ray turns. Instead each obstacle comes as one or more
+// pieces of its extent, keyed on how near the piece comes to the node,
+// which doesn't change, and which is never more than how far along any ray
+// in it the obstacle starts. An obstacle near enough for that to vary a lot
+// is cut into pieces along the sides facing the node, so that within each
+// it varies by no more than twice. A line then only has to be tested
+// against the active pieces nearer than its far end, nearest first, and the
+// first obstacle that blocks it settles it.
+//
+// Each node sorts its events and pieces, O(N log N) with a log of pieces
+// per obstacle, and a line takes O(log M) per obstacle it is tested
+// against. Past the one that blocks it, those are obstacles it passes
+// within the margin of, and ones the ray goes on to meet within about
+// three times the line's length, a bounded number unless obstacles are
+// packed far tighter than the lines are long. That makes it O(N^2 log N),
+// and bench navbuild checks it gives the same graph as the brute force.
+//
+// The graph has to come out exactly as build_nav_edges_brute_force makes it,
+// so extents are taken around each obstacle grown by OBSTACLE_MARGIN, and
+// each pair is still tested with the lower node as x0, y0. The margin is
+// also far wider than any rounding in the sort keys, so those don't have to
+// be exact.
+
+enum NavSweepKind {
+	// the order events at the same angle are handled in
+	NAV_SWEEP_OPEN,
+	NAV_SWEEP_TARGET,
+	NAV_SWEEP_CLOSE,
+};
+
+// Sort keys hold what they are for in the low NAV_SWEEP_INDEX_BITS, an
+// obstacle's piece or a nav node, which the sort leaves in whatever order.
+#define NAV_SWEEP_INDEX_BITS 24
+#define NAV_SWEEP_INDEX ((1ULL << NAV_SWEEP_INDEX_BITS) - 1)
+
+// A pseudo-angle, increasing anticlockwise from 0 along +x to just under 4,
+// without the cost of atan2, turned into a sort key with the kind of event
+// next so that it breaks ties.
+uint64_t nav_sweep_key(num dx, num dy, enum NavSweepKind kind, uint32_t index) {
+	double p = (double)dy / (double)(llabs(dx) + llabs(dy));
+	double angle;
+	if (dx >= 0) {
+		angle = dy >= 0 ? p : 4 + p;
+	} else {
+		angle = 2 - p;
+	}
+	return (uint64_t)(angle * (double)(1ULL << 36)) << (NAV_SWEEP_INDEX_BITS + 2)
+		| (uint64_t)kind << NAV_SWEEP_INDEX_BITS | index;
+}
+
+// LSD radix sort on the keys above the index, a byte at a time, skipping
+// bytes that are the same in every key. Sorts keys, using tmp as scratch.
+void nav_sweep_sort(uint64_t *keys, uint64_t *tmp, size_t n) {
+	// every byte is counted in one pass, since sorting on one doesn't change
+	// how many of each the others have
+	size_t counts[8][256] = {{0}};
+	range(i, n) {
+		for (int b = NAV_SWEEP_INDEX_BITS / 8; b < 8; b++) {
+			counts[b][(keys[i] >> 8 * b) & 0xFF] += 1;
+		}
+	}
+	for (int b = NAV_SWEEP_INDEX_BITS / 8; b < 8; b++) {
+		int shift = 8 * b;
+		if (n == 0 || counts[b][(keys[0] >> shift) & 0xFF] == n) {
+			continue;
+		}
+		size_t total = 0;
+		range(d, 256) {
+			size_t c = counts[b][d];
+			counts[b][d] = total;
+			total += c;
+		}
+		range(i, n) {
+			tmp[counts[b][(keys[i] >> shift) & 0xFF]++] = keys[i];
+		}
+		memcpy(keys, tmp, n * sizeof(*keys));
+	}
+}
+
+int nav_sweep_compare_index(const void *a_, const void *b_) {
+	uint32_t a = *(const uint32_t*)a_;
+	uint32_t b = *(const uint32_t*)b_;
+	return (a > b) - (a < b);
+}
+
+#define NAV_SWEEP_SET_LEVELS 6
+#define NAV_SWEEP_NONE (~(size_t)0)
+
+// The active set, as a bitset over the pieces' ranks by nearness, with a
+// word of summary bits over every 64 words of the level below, so that the
+// next member after any rank is found in a step per level.
+struct NavSweepSet {
+	uint64_t *bits[NAV_SWEEP_SET_LEVELS];
+	size_t words[NAV_SWEEP_SET_LEVELS];
+	int levels;
+};
+
+void nav_sweep_set_alloc(struct NavSweepSet *set, size_t n) {
+	set->levels = 0;
+	do {
+		n = (n + 63) / 64;
+		set->words[set->levels] = n;
+		set->bits[set->levels] = malloc(max(n, 1) * sizeof(uint64_t));
+		if (set->bits[set->levels] == NULL) {
+			printf("ERROR: Out of memory for nav edges\n");
+			exit(1);
+		}
+		set->levels += 1;
+	} while (n > 1);
+}
+
+void nav_sweep_set_clear(struct NavSweepSet *set) {
+	range(l, set->levels) {
+		memset(set->bits[l], 0, set->words[l] * sizeof(uint64_t));
+	}
+}
+
+void nav_sweep_set_free(struct NavSweepSet *set) {
+	range(l, set->levels) {
+		free(set->bits[l]);
+	}
+}
+
+void nav_sweep_set_insert(struct NavSweepSet *set, size_t rank) {
+	range(l, set->levels) {
+		uint64_t *w = &set->bits[l][rank / 64];
+		bool was_empty = *w == 0;
+		*w |= 1ULL << rank % 64;
+		if (!was_empty) {
+			break;
+		}
+		rank /= 64;
+	}
 }
 
-struct PathQueueElem {
-	num dist_so_far;
-	num dist_heuristic;
-	nav curr;
-	nav pred;
-} path_queue[NAV_NODE_CAP];
-size_t path_queue_count;
+void nav_sweep_set_remove(struct NavSweepSet *set, size_t rank) {
+	range(l, set->levels) {
+		uint64_t *w = &set->bits[l][rank / 64];
+		*w &= ~(1ULL << rank % 64);
+		if (*w != 0) {
+			break;
+		}
+		rank /= 64;
+	}
+}
 
-void path_queue_push(num dist, num heuristic, nav curr, nav pred) {
-	struct PathQueueElem new = { dist, heuristic, curr, pred};
-	size_t i;
-	// @Performance binary search or priority queue
-	for (i = 0; i < path_queue_count; i++) {
-		if (new.dist_heuristic < path_queue[i].dist_heuristic) {
+// the lowest rank in the set that is at least rank, or NAV_SWEEP_NONE
+size_t nav_sweep_set_next(struct NavSweepSet *set, size_t rank) {
+	int l = 0;
+	while (true) {
+		if (rank / 64 >= set->words[l]) {
+			return NAV_SWEEP_NONE;
+		}
+		uint64_t w = set->bits[l][rank / 64] & ~0ULL << rank % 64;
+		if (w != 0) {
+			rank = rank / 64 * 64 + __builtin_ctzll(w);
 			break;
 		}
-		if (curr.i == path_queue[i].curr.i) {
-			return;
+		// nothing more in this word, so look past it a level up
+		rank = rank / 64 + 1;
+		l += 1;
+		if (l == set->levels) {
+			return NAV_SWEEP_NONE;
 		}
 	}
-	for (; i < path_queue_count + 1; i++) {
-		struct PathQueueElem tmp = path_queue[i];
-		path_queue[i] = new;
-		if (i < path_queue_count && tmp.curr.i == curr.i) {
-			return;
+	while (l > 0) {
+		l -= 1;
+		rank = rank * 64 + __builtin_ctzll(set->bits[l][rank]);
+	}
+	return rank;
+}
+
+// What build_nav_edges_sweep keeps for the node it is at. It grows as
+// needed, since how many pieces an obstacle is cut into depends on how near
+// the node is to it.
+struct NavSweep {
+	uint64_t *events; // see nav_sweep_key
+	size_t event_count, event_cap;
+	// the obstacle each piece is of, and the pieces by how near they come to
+	// the node, keyed on that
+	uint32_t *piece_obstacle;
+	uint64_t *nearest;
+	uint32_t *rank_of;
+	size_t piece_count, piece_cap;
+	uint64_t *tmp;
+	size_t tmp_cap;
+};
+
+void nav_sweep_add_event(struct NavSweep *w, uint64_t key) {
+	if (w->event_count == w->event_cap) {
+		w->event_cap = max(2 * w->event_cap, 1024);
+		w->events = realloc(w->events, w->event_cap * sizeof(uint64_t));
+		if (w->events == NULL) {
+			printf("ERROR: Out of memory for nav edges\n");
+			exit(1);
 		}
-		new = tmp;
 	}
-	path_queue_count += 1;
+	w->events[w->event_count] = key;
+	w->event_count += 1;
 }
 
-void path_queue_pop() {
-	path_queue_count -= 1;
-	range (i, path_queue_count) {
-		path_queue[i] = path_queue[i + 1];
+// a piece of obstacle o that comes no nearer than gap across or up
+uint32_t nav_sweep_add_piece(struct NavSweep *w, uint32_t o, num gap) {
+	if (w->piece_count == NAV_SWEEP_INDEX) {
+		printf("ERROR: Too many obstacles for the nav sweep\n");
+		exit(1);
+	}
+	if (w->piece_count == w->piece_cap) {
+		w->piece_cap = max(2 * w->piece_cap, 1024);
+		w->piece_obstacle = realloc(w->piece_obstacle, w->piece_cap * sizeof(uint32_t));
+		w->nearest = realloc(w->nearest, w->piece_cap * sizeof(uint64_t));
+		w->rank_of = realloc(w->rank_of, w->piece_cap * sizeof(uint32_t));
+		if (w->piece_obstacle == NULL || w->nearest == NULL || w->rank_of == NULL) {
+			printf("ERROR: Out of memory for nav edges\n");
+			exit(1);
+		}
 	}
+	uint32_t k = w->piece_count;
+	w->piece_obstacle[k] = o;
+	w->nearest[k] = (uint64_t)gap << NAV_SWEEP_INDEX_BITS | k;
+	w->piece_count += 1;
+	return k;
 }
 
-// @Performance scanning line thing
-void pick_route(
+// a piece of obstacle o seen between the directions a and b from the node,
+// in either order
+void nav_sweep_add_span(
+	struct NavSweep *w, uint32_t o, num gap, num ax, num ay, num bx, num by
+) {
+	uint32_t k = nav_sweep_add_piece(w, o, gap);
+	if (ax * by - ay * bx < 0) {
+		num x = ax, y = ay;
+		ax = bx; ay = by;
+		bx = x; by = y;
+	}
+	nav_sweep_add_event(w, nav_sweep_key(ax, ay, NAV_SWEEP_OPEN, k));
+	nav_sweep_add_event(w, nav_sweep_key(bx, by, NAV_SWEEP_CLOSE, k));
+}
+
+// Cuts the side of obstacle o facing the node into pieces, each of which is
+// no more than twice as far away at its furthest as at its nearest, going
+// across or up. The side runs from u0 to u1 at across on the other axis,
+// and the node is at pu along it and h from it.
+//
+// Neighbouring pieces overlap by OBSTACLE_MARGIN, so that rounding in the
+// sort keys can't lose a direction between them.
+void nav_sweep_add_side(
+	struct NavSweep *w, uint32_t o, bool upright,
+	num u0, num u1, num across, num px, num py
+) {
+	num pu = upright ? py : px;
+	num h = llabs(across - (upright ? px : py));
+	num a = u0;
+	while (a < u1) {
+		num b;
+		if (a - pu < -2 * h) {
+			// coming in towards the node
+			b = pu - (pu - a) / 2;
+		} else {
+			// past the node, or near enough to take it in
+			b = pu + 2 * max(h, a - pu);
+		}
+		b = min(b, u1);
+		num from = max(a - OBSTACLE_MARGIN, u0);
+		num to = min(b + OBSTACLE_MARGIN, u1);
+		num gap = h;
+		if (to < pu) {
+			gap = max(h, pu - to);
+		} else if (from > pu) {
+			gap = max(h, from - pu);
+		}
+		if (upright) {
+			nav_sweep_add_span(w, o, gap, across - px, from - py, across - px, to - py);
+		} else {
+			nav_sweep_add_span(w, o, gap, from - px, across - py, to - px, across - py);
+		}
+		a = b;
+	}
+}
+
+void nav_sweep_sort_into(struct NavSweep *w, uint64_t *keys, size_t n) {
+	if (w->tmp_cap < n || w->tmp == NULL) {
+		w->tmp_cap = max(n, 1024);
+		free(w->tmp);
+		w->tmp = malloc(w->tmp_cap * sizeof(uint64_t));
+		if (w->tmp == NULL) {
+			printf("ERROR: Out of memory for nav edges\n");
+			exit(1);
+		}
+	}
+	nav_sweep_sort(keys, w->tmp, n);
+}
+
+void build_nav_edges_sweep(void) {
+	if (nav_node_count > NAV_SWEEP_INDEX) {
+		printf("ERROR: Too many nav nodes for the nav sweep\n");
+		exit(1);
+	}
+	nav_pair_count = 0;
+	struct NavSweep w = {0};
+	uint32_t *always = malloc(max(obstacle_count, 1) * sizeof(uint32_t));
+	uint32_t *visible = malloc(max(nav_node_count, 1) * sizeof(uint32_t));
+	struct NavSweepSet active;
+	size_t active_cap = 0;
+	nav_sweep_set_alloc(&active, active_cap);
+
+	range(i, nav_node_count) {
+		num px = nav_nodes[i].x;
+		num py = nav_nodes[i].y;
+		w.event_count = 0;
+		w.piece_count = 0;
+		size_t always_count = 0;
+		size_t visible_count = 0;
+
+		range(o, obstacle_count) {
+			num l = obstacles[o].l - OBSTACLE_MARGIN;
+			num r = obstacles[o].r + OBSTACLE_MARGIN;
+			num b = obstacles[o].b - OBSTACLE_MARGIN;
+			num t = obstacles[o].t + OBSTACLE_MARGIN;
+			if (l <= px && px <= r && b <= py && py <= t) {
+				// surrounds us, so could block any direction
+				nav_sweep_add_piece(&w, o, 0);
+				always[always_count] = o;
+				always_count += 1;
+				continue;
+			}
+			num gap = max(max(max(l - px, px - r), max(b - py, py - t)), 0);
+			num far = max(max(px - l, r - px), max(py - b, t - py));
+			if (far > 2 * gap) {
+				// near enough that rays across it meet it at very
+				// different distances, so take the sides facing us a
+				// piece at a time
+				if (px < l || px > r) {
+					nav_sweep_add_side(&w, o, true, b, t, px < l ? l : r, px, py);
+				}
+				if (py < b || py > t) {
+					nav_sweep_add_side(&w, o, false, l, r, py < b ? b : t, px, py);
+				}
+				continue;
+			}
+			// from outside, the rectangle spans less than half a turn, so
+			// cross products order its corners, and the extremes are the
+			// ends of its extent
+			num cs[4][2] = {{r, t}, {l, t}, {l, b}, {r, b}};
+			num first[2] = {cs[0][0] - px, cs[0][1] - py};
+			num last[2] = {first[0], first[1]};
+			for (int c = 1; c < 4; c++) {
+				num cx = cs[c][0] - px;
+				num cy = cs[c][1] - py;
+				if (cx * first[1] - cy * first[0] > 0) {
+					first[0] = cx;
+					first[1] = cy;
+				}
+				if (cx * last[1] - cy * last[0] < 0) {
+					last[0] = cx;
+					last[1] = cy;
+				}
+			}
+			nav_sweep_add_span(&w, o, gap, first[0], first[1], last[0], last[1]);
+		}
+
+		nav_sweep_sort_into(&w, w.nearest, w.piece_count);
+		range(k, w.piece_count) {
+			w.rank_of[w.nearest[k] & NAV_SWEEP_INDEX] = k;
+		}
+		if (active_cap < w.piece_count) {
+			nav_sweep_set_free(&active);
+			active_cap = max(2 * active_cap, w.piece_count);
+			nav_sweep_set_alloc(&active, active_cap);
+		}
+		nav_sweep_set_clear(&active);
+		// the pieces around us are the only ones with nothing between, so
+		// they come first, and so far the events are each of the others'
+		// open then close
+		range(k, always_count) {
+			nav_sweep_set_insert(&active, k);
+		}
+		for (size_t e = 0; e < w.event_count; e += 2) {
+			if (w.events[e] > w.events[e + 1]) {
+				// covers the +x direction the sweep starts from
+				nav_sweep_set_insert(&active, w.rank_of[w.events[e] & NAV_SWEEP_INDEX]);
+			}
+		}
+
+		for (size_t j = i + 1; j < nav_node_count; j++) {
+			num dx = nav_nodes[j].x - px;
+			num dy = nav_nodes[j].y - py;
+			if (dx == 0 && dy == 0) {
+				// corners of two obstacles can coincide, and then only an
+				// obstacle around the point can get in the way
+				bool clear = true;
+				range(k, always_count) {
+					if (obstacle_blocks(&obstacles[always[k]], px, py, px, py)) {
+						clear = false;
+						break;
+					}
+				}
+				if (clear) {
+					visible[visible_count] = j;
+					visible_count += 1;
+				}
+				continue;
+			}
+			nav_sweep_add_event(&w, nav_sweep_key(dx, dy, NAV_SWEEP_TARGET, j));
+		}
+
+		nav_sweep_sort_into(&w, w.events, w.event_count);
+
+		// neighbouring lines tend to be blocked by the same obstacle, so try
+		// whichever blocked the last one first
+		struct Obstacle *last_blocker = NULL;
+		range(e, w.event_count) {
+			uint32_t index = w.events[e] & NAV_SWEEP_INDEX;
+			enum NavSweepKind kind = w.events[e] >> NAV_SWEEP_INDEX_BITS & 3;
+			if (kind == NAV_SWEEP_OPEN) {
+				nav_sweep_set_insert(&active, w.rank_of[index]);
+			} else if (kind == NAV_SWEEP_CLOSE) {
+				nav_sweep_set_remove(&active, w.rank_of[index]);
+				if (last_blocker == &obstacles[w.piece_obstacle[index]]) {
+					last_blocker = NULL;
+				}
+			} else {
+				num qx = nav_nodes[index].x;
+				num qy = nav_nodes[index].y;
+				if (last_blocker
+					&& obstacle_blocks(last_blocker, px, py, qx, qy)
+				) {
+					continue;
+				}
+				// an obstacle that blocks the line comes nearer than its
+				// far end
+				uint64_t reach = (qx - px) * (qx - px) + (qy - py) * (qy - py);
+				struct Obstacle *blocker = NULL;
+				for (size_t k = nav_sweep_set_next(&active, 0); !blocker && k != NAV_SWEEP_NONE;
+					k = nav_sweep_set_next(&active, k + 1)
+				) {
+					uint64_t gap = w.nearest[k] >> NAV_SWEEP_INDEX_BITS;
+					if (gap * gap > reach) {
+						break;
+					}
+					struct Obstacle *o = &obstacles[w.piece_obstacle[w.nearest[k] & NAV_SWEEP_INDEX]];
+					if (obstacle_blocks(o, px, py, qx, qy)) {
+						blocker = o;
+					}
+				}
+				if (blocker) {
+					last_blocker = blocker;
+				} else {
+					visible[visible_count] = index;
+					visible_count += 1;
+				}
+			}
+		}
+
+		// adjacency lists come out in node order, same as the brute force
+		qsort(visible, visible_count, sizeof(uint32_t), nav_sweep_compare_index);
+		range(k, visible_count) {
+			nav_add_edge(i, visible[k]);
+		}
+	}
+
+	free(w.events);
+	free(w.piece_obstacle);
+	free(w.nearest);
+	free(w.rank_of);
+	free(w.tmp);
+	free(always);
+	free(visible);
+	nav_sweep_set_free(&active);
+	nav_finish_edges();
+}
+
+void initialize_nav_edges(num world_l, num world_r, num world_b, num world_t) {
+	initialize_nav_nodes(world_l, world_r, world_b, world_t);
+	build_nav_edges_sweep();
+}
+
+#define NAV_NONE (~(size_t)0)
+
+// a node with a clear line from the start, and how far it is
+struct RouteStart {
+	num dist;
+	uint32_t node;
+};
+
+// Everything pick_route needs besides the nav graph itself, so that several
+// threads can route at once, each with its own scratch.
+//
+// The open set is a binary min-heap of nav nodes keyed on f = g + h, and
+// heap_pos records where each node sits in it (-1 when it isn't queued), so
+// that finding a shorter way to a queued node can move it up in place
+// instead of queueing it twice.
+struct RouteScratch {
+	num g[NAV_NODE_CAP]; // shortest distance from the start found so far
+	num f[NAV_NODE_CAP]; // g plus the heuristic
+	num end_dist[NAV_NODE_CAP];
+	bool start_clear[NAV_NODE_CAP];
+	bool end_clear[NAV_NODE_CAP];
+	nav pred[NAV_NODE_CAP];
+	bool closed[NAV_NODE_CAP]; // expanded, with g as short as it gets
+	uint32_t heap[NAV_NODE_CAP];
+	int32_t heap_pos[NAV_NODE_CAP];
+	size_t heap_count;
+	// for pick_route_cached, see route_cache.h
+	struct RouteStart starts[NAV_NODE_CAP];
+	uint32_t end_nodes[NAV_NODE_CAP];
+};
+
+// ties go to the lower node so that routes don't depend on heap history
+bool route_heap_less(struct RouteScratch *s, uint32_t a, uint32_t b) {
+	return s->f[a] < s->f[b] || (s->f[a] == s->f[b] && a < b);
+}
+
+void route_heap_up(struct RouteScratch *s, size_t i) {
+	uint32_t node = s->heap[i];
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!route_heap_less(s, node, s->heap[parent])) {
+			break;
+		}
+		s->heap[i] = s->heap[parent];
+		s->heap_pos[s->heap[i]] = i;
+		i = parent;
+	}
+	s->heap[i] = node;
+	s->heap_pos[node] = i;
+}
+
+void route_heap_down(struct RouteScratch *s, size_t i) {
+	uint32_t node = s->heap[i];
+	while (true) {
+		size_t child = 2 * i + 1;
+		if (child >= s->heap_count) {
+			break;
+		}
+		if (child + 1 < s->heap_count
+			&& route_heap_less(s, s->heap[child + 1], s->heap[child])
+		) {
+			child += 1;
+		}
+		if (!route_heap_less(s, s->heap[child], node)) {
+			break;
+		}
+		s->heap[i] = s->heap[child];
+		s->heap_pos[s->heap[i]] = i;
+		i = child;
+	}
+	s->heap[i] = node;
+	s->heap_pos[node] = i;
+}
+
+// queue node, or move it up if its f just went down
+void route_heap_push_or_decrease(struct RouteScratch *s, uint32_t node) {
+	if (s->heap_pos[node] < 0) {
+		s->heap[s->heap_count] = node;
+		s->heap_count += 1;
+		route_heap_up(s, s->heap_count - 1);
+	} else {
+		route_heap_up(s, s->heap_pos[node]);
+	}
+}
+
+uint32_t route_heap_pop(struct RouteScratch *s) {
+	uint32_t top = s->heap[0];
+	s->heap_pos[top] = -1;
+	s->heap_count -= 1;
+	if (s->heap_count > 0) {
+		s->heap[0] = s->heap[s->heap_count];
+		route_heap_down(s, 0);
+	}
+	return top;
+}
+
+// The straight line distance to the end, rounded down. Edges are rounded
+// up, so going along one never takes off more than its length, which keeps
+// the heuristic consistent.
+num route_heuristic(num end_dist) {
+	return end_dist;
+}
+
+// A* from the start point to the end point through the nav nodes. The end
+// is treated as one more node, reached from any node with a clear line to
+// it, so the search only stops once nothing left in the heap could beat the
+// best way to the end found so far. The heuristic is consistent, so once a
+// node comes off the heap there is no shorter way to it, and it is closed.
+//
+// path_out gets the nodes from last to first.
+//
+// pick_route_search is the search on its own, for callers that have
+// already filled in s->start_clear and s->end_clear.
+void pick_route_search(
+	struct RouteScratch *s,
 	num startx, num starty,
 	num endx, num endy,
 	size_t *path_count, nav *path_out
 ) {
-	static bool covered[NAV_NODE_CAP];
-	static num end_dist[NAV_NODE_CAP];
-	static bool end_clear[NAV_NODE_CAP];
-	static nav pred[NAV_NODE_CAP];
-	path_queue_count = 0;
+	s->heap_count = 0;
 	range (i, nav_node_count) {
-		// @Robustness is ~0U even right?? surely ~0UL or UINT64_MAX... ugh
-		pred[i].i = ~0U;
-		covered[i] = false;
-		num heuristic =
-			num_hypot(endx - nav_nodes[i].x, endy - nav_nodes[i].y);
-		if (!interval_obstructed(startx, starty, nav_nodes[i].x, nav_nodes[i].y)) {
-			num dist =
-				num_hypot(nav_nodes[i].x - startx, nav_nodes[i].y - starty);
-			path_queue_push(dist, dist + heuristic, (nav){i}, (nav){~0U});
-		}
-		end_dist[i] = heuristic;
-		end_clear[i] =
-			!interval_obstructed(nav_nodes[i].x, nav_nodes[i].y, endx, endy);
+		s->pred[i].i = NAV_NONE;
+		s->closed[i] = false;
+		s->heap_pos[i] = -1;
+		s->g[i] = NUM_GREATEST;
+		s->end_dist[i] =
+			fx_hypot(endx - nav_nodes[i].x, endy - nav_nodes[i].y);
+		if (s->start_clear[i]) {
+			s->g[i] =
+				fx_hypot(nav_nodes[i].x - startx, nav_nodes[i].y - starty);
+			s->f[i] = s->g[i] + route_heuristic(s->end_dist[i]);
+			route_heap_push_or_decrease(s, i);
+		}
 	}
-	*path_count = 0;
-	nav end = (nav){~0U};
-	while (path_queue_count > 0) {
-		num dist_so_far = path_queue[0].dist_so_far;
-		nav curr = path_queue[0].curr;
-		covered[curr.i] = true;
-		pred[curr.i] = path_queue[0].pred;
-		path_queue_pop();
-		if (end_clear[curr.i]) {
-			end = curr;
-			break;
+	num best = NUM_GREATEST;
+	nav end = (nav){NAV_NONE};
+	while (s->heap_count > 0 && s->f[s->heap[0]] < best) {
+		uint32_t curr = route_heap_pop(s);
+		s->closed[curr] = true;
+		if (s->end_clear[curr] && s->g[curr] + s->end_dist[curr] < best) {
+			best = s->g[curr] + s->end_dist[curr];
+			end.i = curr;
 		}
-		range (j, nav_adj_counts[curr.i]) {
-			nav next = nav_adj[curr.i][j].it;
-			// @Correctness just because curr is optimal does not mean next
-			// will be... need to change this so that covered[i] and pred[i]
-			// are set only when expanding i, not just queueing i
-			if (!covered[next.i]) {
-				num step_dist = nav_adj[curr.i][j].dist;
-				num dist = dist_so_far + step_dist;
-				path_queue_push(dist, dist + end_dist[next.i], next, curr);
+		for (uint32_t e = nav_edge_start[curr]; e < nav_edge_start[curr + 1]; e++) {
+			size_t next = nav_edge_to[e];
+			if (s->closed[next]) {
+				continue;
 			}
+			num dist = s->g[curr] + nav_edge_dist[e];
+			if (dist >= s->g[next]) {
+				continue;
+			}
+			s->g[next] = dist;
+			s->f[next] = dist + route_heuristic(s->end_dist[next]);
+			s->pred[next].i = curr;
+			route_heap_push_or_decrease(s, next);
 		}
 	}
-	while (end.i != ~0U) {
+	*path_count = 0;
+	while (end.i != NAV_NONE) {
 		path_out[*path_count] = end;
 		*path_count += 1;
-		end = pred[end.i];
+		end = s->pred[end.i];
 	}
 }
 
-
+void pick_route(
+	struct RouteScratch *s,
+	num startx, num starty,
+	num endx, num endy,
+	size_t *path_count, nav *path_out
+) {
+	STAT_INC(pick_route);
+	nav_node_visibility(endx, endy, true, s->end_clear);
+	nav_node_visibility(startx, starty, false, s->start_clear);
+	pick_route_search(s, startx, starty, endx, endy, path_count, path_out);
+}
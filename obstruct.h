@@ -0,0 +1,189 @@
+#pragma once
+
+#include "util.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Division free segment against rectangle tests, so that a segment can be
+// tested against several obstacles at once.
+//
+// obstacle_blocks (nav.h) finds where the line crosses each edge with a
+// truncating division, and compares that with the next edge along. Each of
+// those comparisons can be done without the division: for d > 0 and
+// r = n - k*d,
+//
+//   trunc(n/d) >= k  iff  n >= 0 ? r >= 0 : r > -d
+//   trunc(n/d) <= k  iff  n >= 0 ? r < d : r <= 0
+//
+// so the answers come out exactly the same, rounding and all. Negating both
+// n and d doesn't change trunc(n/d), so the sign of each divisor is folded
+// into the numerators up front.
+//
+// The AVX2 kernel multiplies 32 bit halves, so differences between
+// coordinates have to fit in 32 bits; callers check that coordinates are
+// under OBSTRUCT_COORD_LIMIT.
+#define OBSTRUCT_COORD_LIMIT ((num)1 << 30)
+
+struct ObstructSegment {
+	num x0, y0, x1, y1;
+	num xmin, xmax, ymin, ymax;
+	num adx, sdy; // |dx|, and dy times the sign of dx
+	num ady, sdx; // |dy|, and dx times the sign of dy
+	int gradient; // 0 if axis aligned, otherwise the sign of the gradient
+};
+
+struct ObstructSegment obstruct_segment(num x0, num y0, num x1, num y1) {
+	struct ObstructSegment s;
+	s.x0 = x0;
+	s.y0 = y0;
+	s.x1 = x1;
+	s.y1 = y1;
+	s.xmin = min(x0, x1);
+	s.xmax = max(x0, x1);
+	s.ymin = min(y0, y1);
+	s.ymax = max(y0, y1);
+	num dx = x1 - x0;
+	num dy = y1 - y0;
+	s.adx = dx < 0 ? -dx : dx;
+	s.sdy = dx < 0 ? -dy : dy;
+	s.ady = dy < 0 ? -dy : dy;
+	s.sdx = dy < 0 ? -dx : dx;
+	s.gradient = dx == 0 || dy == 0 ? 0 : (dx < 0) == (dy < 0) ? 1 : -1;
+	return s;
+}
+
+bool obstruct_within_limit(num x, num y) {
+	return -OBSTRUCT_COORD_LIMIT < x && x < OBSTRUCT_COORD_LIMIT
+		&& -OBSTRUCT_COORD_LIMIT < y && y < OBSTRUCT_COORD_LIMIT;
+}
+
+bool trunc_div_ge(num n, num kd, num d) {
+	num r = n - kd;
+	return n >= 0 ? r >= 0 : r > -d;
+}
+
+bool trunc_div_le(num n, num kd, num d) {
+	num r = n - kd;
+	return n >= 0 ? r < d : r <= 0;
+}
+
+// same answer as obstacle_blocks, see there for what the tests mean
+bool obstruct_one(
+	const struct ObstructSegment *s, num l, num r, num b, num t
+) {
+	if (s->xmax <= l || s->xmin >= r || s->ymax <= b || s->ymin >= t) {
+		return false;
+	}
+	if (s->gradient == 0) {
+		return true;
+	}
+	// ly = y0 + trunc(ln/adx), and so on
+	num ln = (l - s->x0) * s->sdy;
+	num rn = (r - s->x0) * s->sdy;
+	num tn = (t - s->y0) * s->sdx;
+	num bn = (b - s->y0) * s->sdx;
+	num t_adx = (t - s->y0) * s->adx;
+	num b_adx = (b - s->y0) * s->adx;
+	num l_ady = (l - s->x0) * s->ady;
+	num r_ady = (r - s->x0) * s->ady;
+	if (s->gradient > 0) {
+		// (ly >= t && tx <= l) || (ry <= b && bx >= r)
+		return !((trunc_div_ge(ln, t_adx, s->adx) && trunc_div_le(tn, l_ady, s->ady))
+			|| (trunc_div_le(rn, b_adx, s->adx) && trunc_div_ge(bn, r_ady, s->ady)));
+	} else {
+		// (ry >= t && tx >= r) || (ly <= b && bx <= l)
+		return !((trunc_div_ge(rn, t_adx, s->adx) && trunc_div_ge(tn, r_ady, s->ady))
+			|| (trunc_div_le(ln, b_adx, s->adx) && trunc_div_le(bn, l_ady, s->ady)));
+	}
+}
+
+#if defined(__AVX2__)
+
+#define OBSTRUCT_LANES 4
+
+__m256i obstruct_ge4(__m256i n, __m256i kd, __m256i d) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i r = _mm256_sub_epi64(n, kd);
+	__m256i if_pos = _mm256_xor_si256(_mm256_cmpgt_epi64(zero, r),
+		_mm256_set1_epi64x(-1));
+	__m256i if_neg = _mm256_cmpgt_epi64(r, _mm256_sub_epi64(zero, d));
+	return _mm256_blendv_epi8(if_pos, if_neg, _mm256_cmpgt_epi64(zero, n));
+}
+
+__m256i obstruct_le4(__m256i n, __m256i kd, __m256i d) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i r = _mm256_sub_epi64(n, kd);
+	__m256i if_pos = _mm256_cmpgt_epi64(d, r);
+	__m256i if_neg = _mm256_xor_si256(_mm256_cmpgt_epi64(r, zero),
+		_mm256_set1_epi64x(-1));
+	return _mm256_blendv_epi8(if_pos, if_neg, _mm256_cmpgt_epi64(zero, n));
+}
+
+// Tests the segment against the four rectangles l[i], r[i], b[i], t[i],
+// returning a bit mask of the ones that block it.
+int obstruct_lanes(
+	const struct ObstructSegment *s,
+	const num *l, const num *r, const num *b, const num *t
+) {
+	__m256i vl = _mm256_loadu_si256((const __m256i*)l);
+	__m256i vr = _mm256_loadu_si256((const __m256i*)r);
+	__m256i vb = _mm256_loadu_si256((const __m256i*)b);
+	__m256i vt = _mm256_loadu_si256((const __m256i*)t);
+	__m256i overlap = _mm256_and_si256(
+		_mm256_and_si256(
+			_mm256_cmpgt_epi64(_mm256_set1_epi64x(s->xmax), vl),
+			_mm256_cmpgt_epi64(vr, _mm256_set1_epi64x(s->xmin))),
+		_mm256_and_si256(
+			_mm256_cmpgt_epi64(_mm256_set1_epi64x(s->ymax), vb),
+			_mm256_cmpgt_epi64(vt, _mm256_set1_epi64x(s->ymin))));
+	int mask = _mm256_movemask_pd(_mm256_castsi256_pd(overlap));
+	if (mask == 0 || s->gradient == 0) {
+		return mask;
+	}
+
+	__m256i x0 = _mm256_set1_epi64x(s->x0);
+	__m256i y0 = _mm256_set1_epi64x(s->y0);
+	__m256i adx = _mm256_set1_epi64x(s->adx);
+	__m256i ady = _mm256_set1_epi64x(s->ady);
+	__m256i sdx = _mm256_set1_epi64x(s->sdx);
+	__m256i sdy = _mm256_set1_epi64x(s->sdy);
+	__m256i lx = _mm256_sub_epi64(vl, x0);
+	__m256i rx = _mm256_sub_epi64(vr, x0);
+	__m256i ty = _mm256_sub_epi64(vt, y0);
+	__m256i by = _mm256_sub_epi64(vb, y0);
+	// everything fits in 32 bits, so _mm256_mul_epi32 gives exact products
+	__m256i ln = _mm256_mul_epi32(lx, sdy);
+	__m256i rn = _mm256_mul_epi32(rx, sdy);
+	__m256i tn = _mm256_mul_epi32(ty, sdx);
+	__m256i bn = _mm256_mul_epi32(by, sdx);
+	__m256i t_adx = _mm256_mul_epi32(ty, adx);
+	__m256i b_adx = _mm256_mul_epi32(by, adx);
+	__m256i l_ady = _mm256_mul_epi32(lx, ady);
+	__m256i r_ady = _mm256_mul_epi32(rx, ady);
+	__m256i miss;
+	if (s->gradient > 0) {
+		miss = _mm256_or_si256(
+			_mm256_and_si256(obstruct_ge4(ln, t_adx, adx), obstruct_le4(tn, l_ady, ady)),
+			_mm256_and_si256(obstruct_le4(rn, b_adx, adx), obstruct_ge4(bn, r_ady, ady)));
+	} else {
+		miss = _mm256_or_si256(
+			_mm256_and_si256(obstruct_ge4(rn, t_adx, adx), obstruct_ge4(tn, r_ady, ady)),
+			_mm256_and_si256(obstruct_le4(ln, b_adx, adx), obstruct_le4(bn, l_ady, ady)));
+	}
+	return mask & ~_mm256_movemask_pd(_mm256_castsi256_pd(miss));
+}
+
+#else
+
+#define OBSTRUCT_LANES 1
+
+int obstruct_lanes(
+	const struct ObstructSegment *s,
+	const num *l, const num *r, const num *b, const num *t
+) {
+	return obstruct_one(s, *l, *r, *b, *t);
+}
+
+#endif
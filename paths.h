@@ -0,0 +1,86 @@
+#pragma once
+
+#include "util.h"
+
+// Storage for the paths characters are following. Every path is a slice of
+// nav node indices in one shared array, so memory follows how many
+// waypoints are actually in use, rather than reserving the longest
+// possible path for every possible character.
+//
+// Slices come in power of two sizes. A freed slice goes on the free list
+// for its size and is handed out again before the array grows, so a steady
+// stream of paths being found and walked doesn't grow it at all. Slices
+// are referred to by offset, which stays valid when the array is
+// reallocated.
+
+#define PATH_CLASS_COUNT 32
+#define PATH_NONE (~(uint32_t)0)
+
+struct PathArena {
+	uint32_t *nodes;
+	size_t used; // nodes ever handed out from the end of the array
+	size_t cap;
+	// first free slice of each size, each linked to the next through its
+	// first entry
+	uint32_t free_head[PATH_CLASS_COUNT];
+	size_t live; // nodes in slices handed out and not yet freed
+	size_t live_peak;
+} path_arena;
+
+// smallest size class whose slices fit count nodes
+uint8_t path_class(size_t count) {
+	uint8_t size_class = 0;
+	while (((size_t)1 << size_class) < count) {
+		size_class += 1;
+	}
+	return size_class;
+}
+
+void path_arena_clear() {
+	path_arena.used = 0;
+	path_arena.live = 0;
+	path_arena.live_peak = 0;
+	range (c, PATH_CLASS_COUNT) {
+		path_arena.free_head[c] = PATH_NONE;
+	}
+}
+
+// A slice of at least count nodes, returned as its offset into
+// path_arena.nodes. Its size class has to be passed back to path_free.
+uint32_t path_alloc(size_t count, uint8_t *size_class_out) {
+	struct PathArena *a = &path_arena;
+	uint8_t size_class = path_class(count);
+	size_t size = (size_t)1 << size_class;
+	uint32_t start = a->free_head[size_class];
+	if (start != PATH_NONE) {
+		a->free_head[size_class] = a->nodes[start];
+	} else {
+		if (a->used + size > a->cap) {
+			a->cap = max(2 * a->cap, max(a->used + size, 1024));
+			a->nodes = realloc(a->nodes, a->cap * sizeof(uint32_t));
+			if (a->nodes == NULL) {
+				printf("ERROR: Out of memory for paths\n");
+				exit(1);
+			}
+		}
+		start = a->used;
+		a->used += size;
+	}
+	a->live += size;
+	a->live_peak = max(a->live_peak, a->live);
+	*size_class_out = size_class;
+	return start;
+}
+
+void path_free(uint32_t start, uint8_t size_class) {
+	struct PathArena *a = &path_arena;
+	a->nodes[start] = a->free_head[size_class];
+	a->free_head[size_class] = start;
+	a->live -= (size_t)1 << size_class;
+}
+
+void path_arena_print_stats() {
+	printf("paths: %lu nodes in use, %lu at most, %lu allocated (%.1f KiB)\n",
+		path_arena.live, path_arena.live_peak, path_arena.used,
+		(double)path_arena.cap * sizeof(uint32_t) / 1024);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "util.h"
+#include "stats.h"
+
+// A fixed set of worker threads that split loops over [0, n) between them.
+// Indices are handed out in batches as threads become free, and the calling
+// thread works through the loop as well, so with one thread pool_run is
+// just a plain call. Work done through the pool must not depend on which
+// worker ran it, other than through per-worker scratch space indexed by
+// the worker argument.
+
+#define POOL_THREAD_CAP 64
+#define POOL_BATCH 32
+
+typedef void (*PoolFn)(size_t begin, size_t end, size_t worker);
+
+struct Pool {
+	size_t thread_count; // including the caller of pool_run
+	pthread_t threads[POOL_THREAD_CAP];
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	uint64_t generation;
+	size_t busy;
+
+	PoolFn fn;
+	size_t next;
+	size_t n;
+} pool = {1};
+
+void pool_work(size_t worker) {
+	while (true) {
+		pthread_mutex_lock(&pool.lock);
+		size_t begin = pool.next;
+		size_t end = min(begin + POOL_BATCH, pool.n);
+		pool.next = end;
+		pthread_mutex_unlock(&pool.lock);
+		if (begin >= end) {
+			break;
+		}
+		pool.fn(begin, end, worker);
+	}
+	STAT_FLUSH_THREAD();
+}
+
+void *pool_thread(void *arg) {
+	size_t worker = (size_t)arg;
+	uint64_t seen = 0;
+	pthread_mutex_lock(&pool.lock);
+	while (true) {
+		while (pool.generation == seen) {
+			pthread_cond_wait(&pool.start, &pool.lock);
+		}
+		seen = pool.generation;
+		pthread_mutex_unlock(&pool.lock);
+
+		pool_work(worker);
+
+		pthread_mutex_lock(&pool.lock);
+		pool.busy -= 1;
+		if (pool.busy == 0) {
+			pthread_cond_signal(&pool.done);
+		}
+	}
+	return NULL;
+}
+
+void pool_init(size_t thread_count) {
+	if (thread_count < 1 || thread_count > POOL_THREAD_CAP) {
+		printf("Thread count must be between 1 and %d\n", POOL_THREAD_CAP);
+		exit(1);
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.start, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pool.thread_count = thread_count;
+	for (size_t t = 1; t < thread_count; t++) {
+		if (pthread_create(&pool.threads[t], NULL, pool_thread, (void*)t)) {
+			printf("Could not start worker thread\n");
+			exit(1);
+		}
+	}
+}
+
+void pool_run(PoolFn fn, size_t n) {
+	if (pool.thread_count <= 1) {
+		fn(0, n, 0);
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.fn = fn;
+	pool.next = 0;
+	pool.n = n;
+	pool.busy = pool.thread_count - 1;
+	pool.generation += 1;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+
+	pool_work(0);
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.busy > 0) {
+		pthread_cond_wait(&pool.done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "util.h"
+#include "data.h"
+#include "sim.h"
+
+// Record and replay of everything from outside that a run depends on: the
+// options that shape the world, the contents of data.txt, and which
+// character was picked out with the mouse on which frame. Everything else
+// follows from those, so a replay goes through the same frames as the run
+// it was recorded from, on any build that hasn't changed what simulate()
+// does, and heavy runs can be timed again build after build.
+//
+// The log is text, a line per entry:
+//
+//   city-sim replay 1
+//   seed S
+//   idim N
+//   chars N
+//   fixture-order dense|sorted
+//   data N, then the N bytes of data.txt and a newline
+//   hash F H         sim_hash() was H after frame F
+//   select F X Y C   a click at X, Y after frame F picked character C, or -1
+//   end F            the run stopped after frame F
+//
+// A replay checks each hash and selection as it gets to them and stops at
+// the first that comes out different, so the frame it reports is within
+// record_hash_every of where the two runs went apart.
+
+#define REPLAY_VERSION 1
+#define MOUSE_RANGE (DIM / 32)
+
+FILE *record_file = NULL;
+// frames between recorded hashes, 1 to check every frame
+long record_hash_every = 60;
+
+enum ReplayEventKind {
+	REPLAY_HASH,
+	REPLAY_SELECT,
+};
+
+struct ReplayEvent {
+	enum ReplayEventKind kind;
+	long frame;
+	num x, y;
+	long selected;
+	uint64_t hash;
+};
+
+struct ReplayEvent *replay_events;
+size_t replay_event_count = 0;
+size_t replay_event_cap = 0;
+size_t replay_cursor = 0;
+bool replaying = false;
+// the last frame of the recorded run, or of its last entry if it was cut
+// short
+long replay_end_frame = 0;
+size_t replay_hashes_checked = 0;
+
+char *record_path = NULL;
+char *replay_path = NULL;
+
+char *read_whole_file(const char *path, size_t *len) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		printf("ERROR: Could not open %s\n", path);
+		exit(1);
+	}
+	size_t cap = 4096;
+	char *buf = malloc(cap);
+	*len = 0;
+	size_t got;
+	while (buf != NULL && (got = fread(buf + *len, 1, cap - *len, f)) > 0) {
+		*len += got;
+		if (*len == cap) {
+			cap *= 2;
+			buf = realloc(buf, cap);
+		}
+	}
+	fclose(f);
+	if (buf == NULL) {
+		printf("ERROR: Out of memory reading %s\n", path);
+		exit(1);
+	}
+	return buf;
+}
+
+void parse_data_bytes(char *data, size_t len) {
+	FILE *f = fmemopen(data, len, "r");
+	if (f == NULL) {
+		printf("ERROR: Recorded data.txt is empty\n");
+		exit(1);
+	}
+	parse_data_from(f);
+	fclose(f);
+}
+
+// Starts recording to path, and reads data.txt in place of parse_data(),
+// from the same bytes that go in the log.
+void record_start(const char *path) {
+	record_file = fopen(path, "wb");
+	if (record_file == NULL) {
+		printf("ERROR: Could not open %s to record to\n", path);
+		exit(1);
+	}
+	size_t len;
+	char *data = read_whole_file("data.txt", &len);
+	fprintf(record_file, "city-sim replay %d\n", REPLAY_VERSION);
+	fprintf(record_file, "seed %lu\n", world_seed);
+	fprintf(record_file, "idim %lu\n", world_idim);
+	fprintf(record_file, "chars %lu\n", char_initial);
+	fprintf(record_file, "fixture-order %s\n",
+		fixture_order == FIXTURE_ORDER_SORTED ? "sorted" : "dense");
+	fprintf(record_file, "data %lu\n", len);
+	fwrite(data, 1, len, record_file);
+	fprintf(record_file, "\n");
+	parse_data_bytes(data, len);
+	free(data);
+}
+
+void record_finish() {
+	if (record_file == NULL) {
+		return;
+	}
+	fprintf(record_file, "end %d\n", frame);
+	fclose(record_file);
+	record_file = NULL;
+}
+
+void replay_corrupt(const char *path, const char *line) {
+	printf("ERROR: Replay log %s has a bad line: %s\n", path, line);
+	exit(1);
+}
+
+// Reads the log at path and sets up the world options and item tables it
+// records, in place of the command line and parse_data().
+void replay_start(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		printf("ERROR: Could not open replay log %s\n", path);
+		exit(1);
+	}
+	char line[256];
+	int version;
+	if (fgets(line, sizeof(line), f) == NULL
+		|| sscanf(line, "city-sim replay %d", &version) != 1
+	) {
+		printf("ERROR: %s isn't a replay log\n", path);
+		exit(1);
+	}
+	if (version != REPLAY_VERSION) {
+		printf("ERROR: Replay log %s is version %d, this build reads version %d\n",
+			path, version, REPLAY_VERSION);
+		exit(1);
+	}
+	replaying = true;
+	replay_event_count = 0;
+	replay_cursor = 0;
+	replay_end_frame = 0;
+	bool have_data = false;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char key[32];
+		char word[32];
+		unsigned long value;
+		struct ReplayEvent e;
+		if (sscanf(line, "%31s", key) != 1) {
+			continue;
+		}
+		if (strcmp(key, "seed") == 0 && sscanf(line, "seed %lu", &value) == 1) {
+			world_seed = value;
+		} else if (strcmp(key, "idim") == 0 && sscanf(line, "idim %lu", &value) == 1) {
+			world_idim = value;
+		} else if (strcmp(key, "chars") == 0 && sscanf(line, "chars %lu", &value) == 1) {
+			char_initial = value;
+		} else if (strcmp(key, "fixture-order") == 0 && sscanf(line, "fixture-order %31s", word) == 1) {
+			fixture_order = strcmp(word, "sorted") == 0 ? FIXTURE_ORDER_SORTED : FIXTURE_ORDER_DENSE;
+		} else if (strcmp(key, "data") == 0 && sscanf(line, "data %lu", &value) == 1) {
+			char *data = malloc(max(value, 1));
+			if (data == NULL || fread(data, 1, value, f) != value) {
+				replay_corrupt(path, line);
+			}
+			parse_data_bytes(data, value);
+			free(data);
+			have_data = true;
+		} else if (strcmp(key, "end") == 0 && sscanf(line, "end %ld", &e.frame) == 1) {
+			replay_end_frame = e.frame;
+		} else {
+			e.kind = REPLAY_HASH;
+			bool ok = false;
+			if (strcmp(key, "hash") == 0) {
+				ok = sscanf(line, "hash %ld %lx", &e.frame, &e.hash) == 2;
+			} else if (strcmp(key, "select") == 0) {
+				e.kind = REPLAY_SELECT;
+				ok = sscanf(line, "select %ld %ld %ld %ld", &e.frame, &e.x, &e.y, &e.selected) == 4;
+			}
+			if (!ok) {
+				replay_corrupt(path, line);
+			}
+			if (replay_event_count == replay_event_cap) {
+				replay_event_cap = max(2 * replay_event_cap, 1024);
+				replay_events = realloc(replay_events, replay_event_cap * sizeof(struct ReplayEvent));
+				if (replay_events == NULL) {
+					printf("ERROR: Out of memory for replay\n");
+					exit(1);
+				}
+			}
+			replay_events[replay_event_count++] = e;
+			replay_end_frame = max(replay_end_frame, e.frame);
+		}
+	}
+	fclose(f);
+	if (!have_data) {
+		printf("ERROR: Replay log %s has no data.txt in it\n", path);
+		exit(1);
+	}
+}
+
+// the character a click at x, y picks out, or -1
+long nearest_char(num x, num y) {
+	ref nearest = find_nearest(x, y, MOUSE_RANGE, is_char, 0);
+	return nearest != -1 ? (long)(nearest & REF_IND) : -1;
+}
+
+// Selects the character nearest x, y with the mouse, recording it with
+// the frame it happened after, if recording.
+long select_char(num x, num y) {
+	long selected = nearest_char(x, y);
+	if (record_file != NULL) {
+		fprintf(record_file, "select %d %ld %ld %ld\n", frame, x, y, selected);
+	}
+	return selected;
+}
+
+// call after init() and after every simulate(), outside of any frame timing
+void replay_frame_done() {
+	if (record_file != NULL && frame % record_hash_every == 0) {
+		fprintf(record_file, "hash %d %016lx\n", frame, sim_hash());
+	}
+	while (replaying && replay_cursor < replay_event_count
+		&& replay_events[replay_cursor].frame <= frame
+	) {
+		struct ReplayEvent *e = &replay_events[replay_cursor++];
+		if (e->kind == REPLAY_HASH) {
+			uint64_t h = sim_hash();
+			if (h != e->hash) {
+				printf("ERROR: Replay diverged by frame %d: state hash %016lx, recorded %016lx\n",
+					frame, h, e->hash);
+				exit(1);
+			}
+			replay_hashes_checked += 1;
+		} else {
+			long selected = nearest_char(e->x, e->y);
+			if (selected != e->selected) {
+				printf("ERROR: Replay diverged by frame %d: a click selected %ld, recorded %ld\n",
+					frame, selected, e->selected);
+				exit(1);
+			}
+		}
+	}
+}
+
+// Options for recording and replaying, shared by every entry point like
+// sim_option.
+bool replay_option(int argc, char **argv, int *i) {
+	if (strcmp(argv[*i], "--record") == 0 && *i + 1 < argc) {
+		*i += 1;
+		record_path = argv[*i];
+		return true;
+	}
+	if (strcmp(argv[*i], "--replay") == 0 && *i + 1 < argc) {
+		*i += 1;
+		replay_path = argv[*i];
+		return true;
+	}
+	if (strcmp(argv[*i], "--record-hash-every") == 0 && *i + 1 < argc) {
+		*i += 1;
+		record_hash_every = atol(argv[*i]);
+		if (record_hash_every < 1) {
+			printf("ERROR: --record-hash-every has to be at least 1\n");
+			exit(1);
+		}
+		return true;
+	}
+	return false;
+}
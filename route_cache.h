@@ -0,0 +1,346 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "util.h"
+#include "fixed.h"
+#include "nav.h"
+
+// Memoized shortest paths over the nav graph, which never changes once
+// initialize_nav_edges has run. For each nav node that has been asked about
+// the cache holds a whole shortest path tree rooted there: the distance to
+// every other node, and each node's predecessor on the way from the root.
+// The path between two nodes can then be read straight off the tree in
+// O(path length).
+//
+// Routing between two points then needs no search at all: the best route
+// is the best combination of a node visible from the start, the tree path
+// from it, and a node with a clear line to the end. Since every tree is
+// exact, the answer doesn't depend on what happens to be cached.
+//
+// A tree costs a few A* searches to build though, so it only pays off for
+// nodes that get routed from again. The first time a start node misses we
+// just route with A* and remember the miss; the tree gets built the next
+// time. A* and the trees agree on the length but can break exact ties
+// differently, so the choice must not depend on thread timing: misses
+// during a batch of routing only count from the next batch on, see
+// route_cache_end_batch. The miss marks live as long as the nav graph, and
+// are saved in snapshots.
+//
+// Trees are evicted least recently used first once the cache grows past
+// cap_bytes. A cap of 0 turns the cache off and routes with A* instead.
+
+struct RouteTree {
+	uint32_t root;
+	uint32_t pins; // threads currently reading it, can't be evicted
+	struct RouteTree *newer;
+	struct RouteTree *older;
+	num *dist;
+	uint32_t *pred;
+};
+
+#define ROUTE_TREE_NONE (~(uint32_t)0)
+
+// whether routing from a node has missed the cache
+enum RouteMissed {
+	ROUTE_MISSED_NEVER,
+	ROUTE_MISSED_THIS_BATCH,
+	ROUTE_MISSED_BEFORE,
+};
+
+struct RouteCacheStats {
+	uint64_t hits;
+	uint64_t misses; // trees built
+	uint64_t cold; // first misses, routed with A* instead
+	uint64_t evictions;
+};
+
+struct RouteCache {
+	pthread_mutex_t lock;
+	size_t cap_bytes;
+	size_t bytes;
+	size_t tree_count;
+	struct RouteTree *trees[NAV_NODE_CAP]; // by root, NULL if not cached
+	struct RouteTree *newest;
+	struct RouteTree *oldest;
+	uint8_t missed[NAV_NODE_CAP]; // enum RouteMissed, by node
+	struct RouteCacheStats stats;
+} route_cache = {PTHREAD_MUTEX_INITIALIZER, 16 << 20};
+
+size_t route_tree_bytes() {
+	return sizeof(struct RouteTree)
+		+ nav_node_count * (sizeof(num) + sizeof(uint32_t));
+}
+
+// Dijkstra from t->root, using the scratch heap keyed on f
+void route_tree_build(struct RouteScratch *s, struct RouteTree *t) {
+	range (i, nav_node_count) {
+		t->dist[i] = NUM_GREATEST;
+		t->pred[i] = ROUTE_TREE_NONE;
+		s->heap_pos[i] = -1;
+	}
+	s->heap_count = 0;
+	t->dist[t->root] = 0;
+	s->f[t->root] = 0;
+	route_heap_push_or_decrease(s, t->root);
+	while (s->heap_count > 0) {
+		uint32_t curr = route_heap_pop(s);
+		for (uint32_t e = nav_edge_start[curr]; e < nav_edge_start[curr + 1]; e++) {
+			size_t next = nav_edge_to[e];
+			num dist = t->dist[curr] + nav_edge_dist[e];
+			if (dist >= t->dist[next]) {
+				continue;
+			}
+			t->dist[next] = dist;
+			t->pred[next] = curr;
+			s->f[next] = dist;
+			route_heap_push_or_decrease(s, next);
+		}
+	}
+}
+
+// call with the lock held
+void route_cache_unlink(struct RouteTree *t) {
+	if (t->newer) {
+		t->newer->older = t->older;
+	} else {
+		route_cache.newest = t->older;
+	}
+	if (t->older) {
+		t->older->newer = t->newer;
+	} else {
+		route_cache.oldest = t->newer;
+	}
+}
+
+// call with the lock held
+void route_cache_link_newest(struct RouteTree *t) {
+	t->older = route_cache.newest;
+	t->newer = NULL;
+	if (route_cache.newest) {
+		route_cache.newest->newer = t;
+	} else {
+		route_cache.oldest = t;
+	}
+	route_cache.newest = t;
+}
+
+// call with the lock held
+void route_cache_trim() {
+	struct RouteTree *t = route_cache.oldest;
+	while (t && route_cache.bytes > route_cache.cap_bytes) {
+		struct RouteTree *newer = t->newer;
+		if (t->pins == 0) {
+			route_cache_unlink(t);
+			route_cache.trees[t->root] = NULL;
+			route_cache.bytes -= route_tree_bytes();
+			route_cache.tree_count -= 1;
+			route_cache.stats.evictions += 1;
+			free(t);
+		}
+		t = newer;
+	}
+}
+
+// Returns the tree rooted at root, building it if it isn't cached and root
+// has missed before. The tree stays valid until it is passed to
+// route_cache_release. Returns NULL on a first miss.
+struct RouteTree *route_cache_acquire(struct RouteScratch *s, uint32_t root) {
+	pthread_mutex_lock(&route_cache.lock);
+	struct RouteTree *t = route_cache.trees[root];
+	if (t) {
+		route_cache.stats.hits += 1;
+		t->pins += 1;
+		route_cache_unlink(t);
+		route_cache_link_newest(t);
+		pthread_mutex_unlock(&route_cache.lock);
+		return t;
+	}
+	if (route_cache.missed[root] != ROUTE_MISSED_BEFORE) {
+		route_cache.missed[root] = ROUTE_MISSED_THIS_BATCH;
+		route_cache.stats.cold += 1;
+		pthread_mutex_unlock(&route_cache.lock);
+		return NULL;
+	}
+	route_cache.stats.misses += 1;
+	pthread_mutex_unlock(&route_cache.lock);
+
+	// build outside the lock so other threads can keep routing
+	t = malloc(route_tree_bytes());
+	if (!t) {
+		printf("Could not allocate route tree\n");
+		exit(1);
+	}
+	t->root = root;
+	t->pins = 0;
+	t->dist = (num*)(t + 1);
+	t->pred = (uint32_t*)(t->dist + nav_node_count);
+	route_tree_build(s, t);
+
+	pthread_mutex_lock(&route_cache.lock);
+	if (route_cache.trees[root]) {
+		// another thread built the same tree meanwhile
+		free(t);
+		t = route_cache.trees[root];
+		route_cache_unlink(t);
+	} else {
+		route_cache.trees[root] = t;
+		route_cache.bytes += route_tree_bytes();
+		route_cache.tree_count += 1;
+	}
+	t->pins += 1;
+	route_cache_link_newest(t);
+	route_cache_trim();
+	pthread_mutex_unlock(&route_cache.lock);
+	return t;
+}
+
+void route_cache_release(struct RouteTree *t) {
+	pthread_mutex_lock(&route_cache.lock);
+	t->pins -= 1;
+	route_cache_trim();
+	pthread_mutex_unlock(&route_cache.lock);
+}
+
+// Call between batches of routing, with no routing going on. Misses from
+// the batch that just ended get trees built from here on.
+void route_cache_end_batch() {
+	range (i, nav_node_count) {
+		if (route_cache.missed[i] == ROUTE_MISSED_THIS_BATCH) {
+			route_cache.missed[i] = ROUTE_MISSED_BEFORE;
+		}
+	}
+}
+
+// drop every tree and miss, for when the nav graph changes
+void route_cache_clear() {
+	pthread_mutex_lock(&route_cache.lock);
+	struct RouteTree *t = route_cache.oldest;
+	while (t) {
+		struct RouteTree *newer = t->newer;
+		route_cache.trees[t->root] = NULL;
+		free(t);
+		t = newer;
+	}
+	route_cache.newest = NULL;
+	route_cache.oldest = NULL;
+	route_cache.bytes = 0;
+	route_cache.tree_count = 0;
+	memset(route_cache.missed, ROUTE_MISSED_NEVER, sizeof(route_cache.missed));
+	pthread_mutex_unlock(&route_cache.lock);
+}
+
+// the nodes on the shortest path from a to b, last to first, given the tree
+// rooted at a
+void route_tree_path(
+	struct RouteTree *t, uint32_t b, size_t *path_count, nav *path_out
+) {
+	*path_count = 0;
+	if (t->dist[b] == NUM_GREATEST) {
+		return;
+	}
+	for (uint32_t n = b; n != ROUTE_TREE_NONE; n = t->pred[n]) {
+		path_out[*path_count].i = n;
+		*path_count += 1;
+	}
+}
+
+int route_start_compare(const void *a, const void *b) {
+	const struct RouteStart *x = a, *y = b;
+	if (x->dist != y->dist) {
+		return x->dist < y->dist ? -1 : 1;
+	}
+	return (x->node > y->node) - (x->node < y->node);
+}
+
+// same interface as pick_route, but answered from the cache
+void pick_route_cached(
+	struct RouteScratch *s,
+	num startx, num starty,
+	num endx, num endy,
+	size_t *path_count, nav *path_out
+) {
+	if (route_cache.cap_bytes == 0) {
+		pick_route(s, startx, starty, endx, endy, path_count, path_out);
+		return;
+	}
+	STAT_INC(pick_route);
+	// start nodes are kept sorted by distance from the start, so that we
+	// can stop as soon as getting to the next one is already too far
+	size_t start_count = 0;
+	size_t end_count = 0;
+	nav_node_visibility(endx, endy, true, s->end_clear);
+	nav_node_visibility(startx, starty, false, s->start_clear);
+	range (i, nav_node_count) {
+		if (s->end_clear[i]) {
+			s->end_dist[i] =
+				fx_hypot(endx - nav_nodes[i].x, endy - nav_nodes[i].y);
+			s->end_nodes[end_count] = i;
+			end_count += 1;
+		}
+		if (s->start_clear[i]) {
+			num dist =
+				fx_hypot(nav_nodes[i].x - startx, nav_nodes[i].y - starty);
+			s->starts[start_count].dist = dist;
+			s->starts[start_count].node = i;
+			start_count += 1;
+		}
+	}
+	qsort(s->starts, start_count, sizeof(s->starts[0]), route_start_compare);
+
+	*path_count = 0;
+	num best = NUM_GREATEST;
+	uint32_t best_end = ROUTE_TREE_NONE;
+	struct RouteTree *best_tree = NULL;
+	range (k, start_count) {
+		uint32_t a = s->starts[k].node;
+		num dist = s->starts[k].dist;
+		if (dist >= best) {
+			break;
+		}
+		struct RouteTree *t = route_cache_acquire(s, a);
+		if (!t) {
+			if (best_tree) {
+				route_cache_release(best_tree);
+			}
+			pick_route_search(s, startx, starty, endx, endy, path_count, path_out);
+			return;
+		}
+		bool improved = false;
+		range (m, end_count) {
+			uint32_t b = s->end_nodes[m];
+			if (t->dist[b] == NUM_GREATEST) {
+				continue;
+			}
+			num total = dist + t->dist[b] + s->end_dist[b];
+			if (total < best) {
+				best = total;
+				best_end = b;
+				improved = true;
+			}
+		}
+		if (improved) {
+			if (best_tree) {
+				route_cache_release(best_tree);
+			}
+			best_tree = t;
+		} else {
+			route_cache_release(t);
+		}
+	}
+	if (best_tree) {
+		route_tree_path(best_tree, best_end, path_count, path_out);
+		route_cache_release(best_tree);
+	}
+}
+
+void route_cache_print_stats() {
+	struct RouteCacheStats *st = &route_cache.stats;
+	uint64_t lookups = st->hits + st->misses + st->cold;
+	printf("route cache: %lu hits, %lu misses (%.1f%% hit rate), %lu of them"
+		" first misses routed with A*, %lu evictions, %lu trees in %.1f of %.1f MiB\n",
+		st->hits, st->misses + st->cold,
+		lookups ? 100.0 * st->hits / lookups : 0.0, st->cold, st->evictions, route_cache.tree_count,
+		(double)route_cache.bytes / (1 << 20),
+		(double)route_cache.cap_bytes / (1 << 20));
+}
@@ -1,3 +1,3 @@
 #!/bin/sh
 export VK_LAYER_PATH=/usr/share/vulkan/explicit_layer.d
-tcc `pkg-config --static --libs glfw3` -lvulkan main.c -run
+tcc `pkg-config --static --libs glfw3` -lvulkan -lpthread main.c -run
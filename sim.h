@@ -1,15 +1,40 @@
 #pragma once
 
 #include "util.h"
+#include "fixed.h"
 #include "data.h"
 #include "nav.h"
+#include "stats.h"
+#include "move.h"
+#include "pool.h"
+#include "route_cache.h"
+#include "paths.h"
+#include "timers.h"
 
 int frame = 0;
 
-// @Robustness why do large IDIM values cause a segfault?
+// threads used by simulate(), see pool.h
+size_t sim_threads = 1;
+
+// everything random in a world is drawn from streams split off this seed
+uint64_t world_seed = 0;
+
+enum RngStream {
+	RNG_STREAM_OBSTACLES = 1,
+	RNG_STREAM_ITEMS,
+	// one stream per character, RNG_STREAM_CHARS + i
+	RNG_STREAM_CHARS = 1ULL << 32,
+};
+
+// The world runs from -DIM to DIM on each axis. Everything sized by it is
+// allocated by init(), so the size can be picked at startup with --idim.
+#ifndef IDIM
 #define IDIM 50
-#define DIM_CTIME (UNIT_CTIME * IDIM)
-const num DIM = DIM_CTIME;
+#endif
+// keeps differences between coordinates, and their squares, in range
+#define IDIM_CAP 16384
+size_t world_idim = IDIM;
+num DIM = UNIT_CTIME * IDIM;
 
 struct Item {
 	int change_frame;
@@ -18,16 +43,32 @@ struct Item {
 typedef struct Item *Item;
 
 
-#define CHAR_CAP (IDIM * IDIM / 4)
+// set from world_idim by init(), along with fixture_cap and chunk_dim
+size_t char_cap;
 //#define CHAR_INITIAL (IDIM * IDIM / 512)
 #define CHAR_INITIAL 20
+size_t char_initial = CHAR_INITIAL;
 
 #define REACH (UNIT)
 #define MAX_HEALTH 60
 
 size_t char_count = 0;
 
-struct Char {
+// Characters are stored as a structure of arrays, split up by which phase
+// of simulate() reads them, so that the movement loop only has to pull
+// positions and velocities through the cache, and the navigation loop
+// doesn't drag recipe state along with it.
+struct CharNav {
+	// the nodes still to visit are path_arena.nodes[path_start] up to
+	// path_arena.nodes[path_start + path_count], last one first
+	uint32_t path_start;
+	uint32_t path_count;
+	uint8_t path_class;
+	long next_nav_frame;
+	num endx, endy;
+};
+
+struct CharCraft {
 	// int deadframe;
 	Recipe goal;
 	num craft_x, craft_y;
@@ -35,18 +76,44 @@ struct Char {
 	uint8_t input_count;
 	long inputs[RECIPE_INPUT_CAP];
 	struct Item held_item;
+};
 
-	num x, y;
-	num velx, vely;
-	size_t path_count;
-	long next_nav_frame;
-	num endx, endy;
-} chars[CHAR_CAP];
+struct Chars {
+	num *x, *y;
+	num *velx, *vely;
+	struct CharNav *nav;
+	struct CharCraft *craft;
+	struct Rng *rng;
+} chars;
+
+// characters that moved into a different chunk this frame, see move_kernel
+uint32_t *crossed, *crossed_from_x, *crossed_from_y;
 
-nav char_paths[CHAR_CAP][NAV_NODE_CAP];
+// one per pool worker
+struct RouteScratch route_scratch[POOL_THREAD_CAP];
+nav route_paths[POOL_THREAD_CAP][NAV_NODE_CAP];
 
-#define FIXTURE_CAP (IDIM * IDIM / 16)
-#define ITEM_INITIAL (IDIM * IDIM / 64)
+// Characters that reach the end of their path and find their destination
+// obstructed get routed in a batch on the pool at the start of the
+// navigation phase; the results are picked up by the serial loop after.
+// Workers can't share path_arena, so each appends the paths it finds to
+// its own route_output, and the serial loop copies them over.
+uint32_t *route_requests;
+size_t route_request_count;
+struct RouteResult {
+	bool obstructed;
+	uint8_t worker;
+	uint32_t path_count;
+	uint32_t offset; // into route_outputs[worker].nodes
+} *route_results;
+struct RouteOutput {
+	uint32_t *nodes;
+	size_t count;
+	size_t cap;
+} route_outputs[POOL_THREAD_CAP];
+
+size_t fixture_cap;
+size_t item_initial;
 
 #define STORAGE_CAP 1
 
@@ -56,18 +123,41 @@ struct Fixture {
 	int change_frame;
 	int storage_count;
 	struct Item storage[STORAGE_CAP];
-} fixtures[FIXTURE_CAP];
+	uint32_t type_slot[STORAGE_CAP]; // where storage[j] is in its type list
+	int touched; // see touch_fixture
+} *fixtures;
 
 typedef struct Fixture *Fixture;
 
+// Fixture slots are recycled through a free list, and the live ones are
+// listed in live_fixtures, each knowing its place there, so creating and
+// destroying a fixture doesn't depend on how many there are.
+//
+// By default the last slot freed is reused first and live_fixtures is in
+// whatever order swap-removes leave it. FIXTURE_ORDER_SORTED instead reuses
+// the lowest free slot and puts live_fixtures back in slot order before the
+// item phase or sim_hash walk it, which is how fixtures were kept before,
+// so runs can be compared with older builds.
+enum FixtureOrder {
+	FIXTURE_ORDER_DENSE,
+	FIXTURE_ORDER_SORTED,
+};
+enum FixtureOrder fixture_order = FIXTURE_ORDER_DENSE;
+
 size_t fixture_count = 0;
-Fixture live_fixtures[FIXTURE_CAP];
+Fixture *live_fixtures;
+uint32_t *fixture_live_slot; // where each live fixture is in live_fixtures
+bool live_fixtures_sorted;
+// free slots below fixture_used, a stack, or a min heap when sorted
+uint32_t *fixture_free;
+size_t fixture_free_count;
+size_t fixture_used; // slots handed out at some point since init()
 
 #define AWARENESS (UNIT_CTIME * 32)
 
-#define CHUNK_SIZE (UNIT_CTIME * 16)
-#define CHUNK_DIM (2 * DIM_CTIME / CHUNK_SIZE + 1)
-#define CHUNK_BUFFER_SIZE 1024
+// chunks are a power of two across so the movement kernel can shift
+#define CHUNK_SHIFT 20
+#define CHUNK_SIZE (1ULL << CHUNK_SHIFT) // 16 units
 
 typedef uint32_t ref;
 #define REF_SHIFT 31
@@ -76,88 +166,338 @@ const ref REF_FIXTURE = 1u<<REF_SHIFT;
 const ref REF_SORT = ~0u<<REF_SHIFT;
 const ref REF_IND = ~(~0u<<REF_SHIFT);
 
+// Characters are only looked at by the decision and navigation phases on
+// frames they have something to do. Each phase keeps a timer per character
+// for the next frame it needs looking at, see decide_schedule and
+// nav_continue_at, and characters waiting on something in the world watch
+// the chunks it is in, to be woken when those change.
+struct Timers decide_timers;
+struct Timers nav_timers;
+// the character the decision phase is up to, -1 before it starts and
+// LONG_MAX once it is done
+long decide_cursor = -1;
+// bumped whenever a character is woken, which cancels all its watches
+uint32_t *char_watch_epoch;
+
+struct Watch {
+	uint32_t who;
+	uint32_t epoch;
+};
+
+// Characters waiting on one thing, to be woken all at once. A watch only
+// counts while its epoch is still the character's, so cancelled ones are
+// left in place and only cleared out when the list would otherwise grow.
+struct Watchers {
+	struct Watch *list;
+	uint32_t count;
+	uint32_t cap;
+};
+
+// Wakes character i for the decision phase, on this frame if the phase
+// hasn't got to it yet, just as if it had been looking all along.
+void wake_char(size_t i) {
+	char_watch_epoch[i] += 1;
+	timers_add(&decide_timers, (long)i > decide_cursor ? frame : frame + 1, i);
+}
+
+// Each chunk lists what is in it, and everything in a chunk remembers where
+// it is in that list, so it can be taken out without searching.
 struct Chunk {
 	long total_num;
-	ref refs[CHUNK_BUFFER_SIZE];
-} chunks[CHUNK_DIM][CHUNK_DIM];
+	long cap; // refs grows as needed
+	int touched; // see touch_fixture
+	ref *refs;
+	// characters to wake when a fixture here changes, see touch_fixture
+	struct Watchers watchers;
+} *chunks;
+size_t chunk_dim; // chunks across, chunks has chunk_dim * chunk_dim
+uint32_t *char_chunk_slot; // index into its chunk's refs, per character
+uint32_t *fixture_chunk_slot; // and per fixture
 
 #define get_chunk(x) (((x)+DIM)/CHUNK_SIZE)
 
-bool chunk_remove(struct Chunk *chunk, ref r) {
-	range (i, chunk->total_num) {
-		if (chunk->refs[i] == r) {
-			chunk->total_num--;
-			chunk->refs[i] = chunk->refs[chunk->total_num];
-			chunk->refs[chunk->total_num] = 0;
-			return true;
+struct Chunk *chunk_at(size_t ci, size_t cj) {
+	return &chunks[ci * chunk_dim + cj];
+}
+
+// the chunks that a search of radius r around x, y has to look at
+void chunk_range(
+	num x, num y, num r,
+	size_t *cl, size_t *cr, size_t *cu, size_t *cd
+) {
+	*cl = get_chunk(max(x - r, 1-DIM));
+	*cr = get_chunk(min(x + r, DIM-1));
+	*cu = get_chunk(max(y - r, 1-DIM));
+	*cd = get_chunk(min(y + r, DIM-1));
+}
+
+// character i's next waypoint is due on frame f
+void nav_continue_at(size_t i, long f) {
+	chars.nav[i].next_nav_frame = f;
+	timers_add(&nav_timers, f, i);
+}
+
+// character i has got where it was going, or given up
+void nav_stop(size_t i) {
+	chars.nav[i].next_nav_frame = -1;
+	wake_char(i);
+}
+
+void watchers_add(struct Watchers *ws, size_t i) {
+	if (ws->count == ws->cap) {
+		// drop watches that have already been cancelled before growing
+		uint32_t kept = 0;
+		range (k, ws->count) {
+			struct Watch w = ws->list[k];
+			if (w.epoch == char_watch_epoch[w.who]) {
+				ws->list[kept++] = w;
+			}
 		}
+		ws->count = kept;
 	}
-	return false;
+	if (ws->count == ws->cap) {
+		ws->cap = max(2 * ws->cap, 4);
+		ws->list = realloc(ws->list, ws->cap * sizeof(struct Watch));
+		if (ws->list == NULL) {
+			printf("ERROR: Out of memory for watches\n");
+			exit(1);
+		}
+	}
+	ws->list[ws->count++] = (struct Watch){i, char_watch_epoch[i]};
 }
 
-void chunk_remove_char(long i) {
-	struct Char c = chars[i];
-	size_t ci = get_chunk(c.x);
-	size_t cj = get_chunk(c.y);
-	if (!chunk_remove(&chunks[ci][cj], i | REF_CHAR)) {
+void watchers_wake(struct Watchers *ws) {
+	range (k, ws->count) {
+		struct Watch w = ws->list[k];
+		if (w.epoch == char_watch_epoch[w.who]) {
+			wake_char(w.who);
+		}
+	}
+	ws->count = 0;
+}
+
+// Every change to a fixture stamps it and its chunk with the current epoch,
+// so that the decision phase can tell whether a plan made earlier in the
+// frame has been undermined since, and wakes anyone watching the chunk.
+int touch_epoch = 0;
+
+void touch_fixture(long i) {
+	fixtures[i].touched = touch_epoch;
+	struct Chunk *chunk = chunk_at(get_chunk(fixtures[i].x), get_chunk(fixtures[i].y));
+	chunk->touched = touch_epoch;
+	watchers_wake(&chunk->watchers);
+}
+
+uint32_t *chunk_slot(ref r) {
+	if ((r & REF_SORT) == REF_CHAR) {
+		return &char_chunk_slot[r & REF_IND];
+	} else {
+		return &fixture_chunk_slot[r & REF_IND];
+	}
+}
+
+bool chunk_remove(struct Chunk *chunk, ref r) {
+	uint32_t i = *chunk_slot(r);
+	if (i >= chunk->total_num || chunk->refs[i] != r) {
+		return false;
+	}
+	chunk->total_num--;
+	ref last = chunk->refs[chunk->total_num];
+	chunk->refs[i] = last;
+	*chunk_slot(last) = i;
+	return true;
+}
+
+void chunk_remove_char_from(long i, size_t ci, size_t cj) {
+	if (!chunk_remove(chunk_at(ci, cj), i | REF_CHAR)) {
 		printf("WARNING: char %ld not removed from chunk %lu, %lu\n", i, ci, cj);
 	}
 }
 
+void chunk_remove_char(long i) {
+	chunk_remove_char_from(i, get_chunk(chars.x[i]), get_chunk(chars.y[i]));
+}
+
 void chunk_remove_fixture(long i) {
 	struct Fixture c = fixtures[i];
 	size_t ci = get_chunk(c.x);
 	size_t cj = get_chunk(c.y);
-	if (!chunk_remove(&chunks[ci][cj], i | REF_FIXTURE)) {
+	if (!chunk_remove(chunk_at(ci, cj), i | REF_FIXTURE)) {
 		printf("WARNING: fixture %ld not removed from chunk %lu, %lu\n", i, ci, cj);
 	}
 }
 
 int high_water = 0;
 
-void chunk_add_char(long i) {
-	struct Char c = chars[i];
-	size_t ci = get_chunk(c.x), cj = get_chunk(c.y);
-	struct Chunk *chunk = &chunks[ci][cj];
-	if (chunk->total_num == CHUNK_BUFFER_SIZE) {
-		printf("ERROR: chunk %lu, %lu is full\n", ci, cj);
-		exit(1);
+void chunk_add(size_t ci, size_t cj, ref r) {
+	struct Chunk *chunk = chunk_at(ci, cj);
+	if (chunk->total_num == chunk->cap) {
+		chunk->cap = max(2 * chunk->cap, 16);
+		chunk->refs = realloc(chunk->refs, chunk->cap * sizeof(ref));
+		if (chunk->refs == NULL) {
+			printf("ERROR: Out of memory for chunk %lu, %lu\n", ci, cj);
+			exit(1);
+		}
 	}
-	chunk->refs[chunk->total_num++] = i | REF_CHAR;
+	*chunk_slot(r) = chunk->total_num;
+	chunk->refs[chunk->total_num++] = r;
 	high_water = max(high_water, chunk->total_num);
 }
+
+void chunk_add_char(long i) {
+	chunk_add(get_chunk(chars.x[i]), get_chunk(chars.y[i]), i | REF_CHAR);
+}
+
 void chunk_add_fixture(long i) {
-	struct Fixture c = fixtures[i];
-	size_t ci = get_chunk(c.x), cj = get_chunk(c.y);
-	struct Chunk *chunk = &chunks[ci][cj];
-	if (chunk->total_num == CHUNK_BUFFER_SIZE) {
-		printf("ERROR: chunk %lu, %lu is full\n", ci, cj);
-		exit(1);
+	chunk_add(get_chunk(fixtures[i].x), get_chunk(fixtures[i].y), i | REF_FIXTURE);
+}
+
+// For each chunk and item type, the fixtures in that chunk holding that
+// type, once per item, so a search for a recipe input only looks at
+// fixtures that could be one. Kept up to date by fixture_index_add and
+// fixture_index_remove wherever storage changes.
+struct TypeList {
+	ref *refs;
+	uint32_t count;
+	uint32_t cap;
+	// characters whose search for this type came up empty, woken when one
+	// turns up here, see decide_schedule
+	struct Watchers watchers;
+} *chunk_types;
+size_t chunk_type_count; // chunk_dim * chunk_dim * item_type_count
+
+struct TypeList *chunk_type_list(size_t ci, size_t cj, ItemType type) {
+	return &chunk_types[(ci * chunk_dim + cj) * item_type_count + (type - item_types)];
+}
+
+struct TypeList *fixture_type_list(long i, ItemType type) {
+	return chunk_type_list(get_chunk(fixtures[i].x), get_chunk(fixtures[i].y), type);
+}
+
+// index storage[j] of fixture i
+void fixture_index_add(long i, size_t j) {
+	ItemType type = fixtures[i].storage[j].type;
+	if (type == NULL) {
+		return;
 	}
-	chunk->refs[chunk->total_num++] = i | REF_FIXTURE;
-	high_water = max(high_water, chunk->total_num);
+	struct TypeList *list = fixture_type_list(i, type);
+	if (list->count == list->cap) {
+		list->cap = max(2 * list->cap, 4);
+		list->refs = realloc(list->refs, list->cap * sizeof(ref));
+		if (list->refs == NULL) {
+			printf("ERROR: Out of memory for item type lists\n");
+			exit(1);
+		}
+	}
+	fixtures[i].type_slot[j] = list->count;
+	list->refs[list->count++] = i | REF_FIXTURE;
+	watchers_wake(&list->watchers);
 }
 
-size_t create_fixture(num x, num y, struct Item it) {
-	if (fixture_count == FIXTURE_CAP) {
-		printf("Reached fixture capacity\n");
-		exit(1);
+// unindex storage[j] of fixture i, before it changes
+void fixture_index_remove(long i, size_t j) {
+	ItemType type = fixtures[i].storage[j].type;
+	if (type == NULL) {
+		return;
+	}
+	struct TypeList *list = fixture_type_list(i, type);
+	uint32_t k = fixtures[i].type_slot[j];
+	list->count -= 1;
+	ref last = list->refs[list->count];
+	list->refs[k] = last;
+	// whichever item of that fixture was at the end now lives at k
+	Fixture moved = &fixtures[last & REF_IND];
+	range (s, moved->storage_count) {
+		if (moved->storage[s].type == type && moved->type_slot[s] == list->count) {
+			moved->type_slot[s] = k;
+			break;
+		}
+	}
+}
+
+// takes storage[j] out of fixture i, moving the last item into its place
+struct Item fixture_take(long i, size_t j) {
+	Fixture fx = &fixtures[i];
+	struct Item it = fx->storage[j];
+	fixture_index_remove(i, j);
+	fx->storage_count -= 1;
+	fx->storage[j] = fx->storage[fx->storage_count];
+	fx->type_slot[j] = fx->type_slot[fx->storage_count];
+	return it;
+}
+
+void fixture_free_push(uint32_t i) {
+	size_t k = fixture_free_count++;
+	if (fixture_order == FIXTURE_ORDER_SORTED) {
+		while (k > 0 && fixture_free[(k - 1) / 2] > i) {
+			fixture_free[k] = fixture_free[(k - 1) / 2];
+			k = (k - 1) / 2;
+		}
+	}
+	fixture_free[k] = i;
+}
+
+uint32_t fixture_free_pop() {
+	fixture_free_count -= 1;
+	if (fixture_order != FIXTURE_ORDER_SORTED) {
+		return fixture_free[fixture_free_count];
 	}
-	size_t i = 0;
-	{
-		while (i < fixture_count && live_fixtures[i] == &fixtures[i]) {
-			i += 1;
+	uint32_t top = fixture_free[0];
+	uint32_t last = fixture_free[fixture_free_count];
+	size_t k = 0;
+	while (2 * k + 1 < fixture_free_count) {
+		size_t child = 2 * k + 1;
+		if (child + 1 < fixture_free_count && fixture_free[child + 1] < fixture_free[child]) {
+			child += 1;
+		}
+		if (last <= fixture_free[child]) {
+			break;
 		}
-		size_t j = i;
-		Fixture insert = &fixtures[i];
-		fixture_count += 1;
-		while (j < fixture_count) {
-			Fixture tmp = live_fixtures[j];
-			live_fixtures[j] = insert;
-			insert = tmp;
-			j += 1;
+		fixture_free[k] = fixture_free[child];
+		k = child;
+	}
+	fixture_free[k] = last;
+	return top;
+}
+
+void sort_live_fixtures() {
+	if (fixture_order != FIXTURE_ORDER_SORTED || live_fixtures_sorted) {
+		return;
+	}
+	size_t k = 0;
+	range (i, fixture_used) {
+		if (fixtures[i].type != NULL) {
+			fixture_live_slot[i] = k;
+			live_fixtures[k] = &fixtures[i];
+			k += 1;
 		}
 	}
+	live_fixtures_sorted = true;
+}
+
+// Every item due to turn into something else has a timer here for its
+// change_frame, owned by the ref of the character holding it or the
+// fixture storing it, so the item phase only visits those. Items get one
+// whenever they are put somewhere, see item_timer_add.
+struct Timers item_timers;
+
+void item_timer_add(ref owner, struct Item it) {
+	if (it.type != NULL && it.change_frame >= 0) {
+		timers_add(&item_timers, it.change_frame, owner);
+	}
+}
+
+size_t create_fixture(num x, num y, struct Item it) {
+	STAT_INC(create_fixture);
+	if (fixture_count == fixture_cap) {
+		printf("Reached fixture capacity\n");
+		exit(1);
+	}
+	size_t i = fixture_free_count > 0 ? fixture_free_pop() : fixture_used++;
+	fixture_live_slot[i] = fixture_count;
+	live_fixtures[fixture_count] = &fixtures[i];
+	fixture_count += 1;
+	live_fixtures_sorted = false;
 	Fixture fx = &fixtures[i];
 	fx->x = x;
 	fx->y = y;
@@ -165,35 +505,41 @@ size_t create_fixture(num x, num y, struct Item it) {
 	fx->storage_count = 1;
 	fx->storage[0] = it;
 	chunk_add_fixture(i);
+	fixture_index_add(i, 0);
+	item_timer_add(i | REF_FIXTURE, it);
+	touch_fixture(i);
 	return i;
 }
 
 void destroy_fixture(long fx_i) {
+	STAT_INC(destroy_fixture);
 	Fixture fx = &fixtures[fx_i];
-	chunk_remove_fixture(fx_i);
-	fx->type = NULL;
-	size_t i = 0;
-	while (i < fixture_count && live_fixtures[i] < fx) {
-		i++;
-	}
-	if (live_fixtures[i] != fx) {
+	size_t k = fixture_live_slot[fx_i];
+	if (fx->type == NULL || k >= fixture_count || live_fixtures[k] != fx) {
 		printf("WARNING: fixture %ld destroyed while not live\n", fx_i);
 		return;
 	}
-	fixture_count -= 1;
-	while (i < fixture_count) {
-		live_fixtures[i] = live_fixtures[i+1];
-		i++;
+	touch_fixture(fx_i);
+	chunk_remove_fixture(fx_i);
+	range (j, fx->storage_count) {
+		fixture_index_remove(fx_i, j);
 	}
+	fx->type = NULL;
+	fixture_count -= 1;
+	Fixture last = live_fixtures[fixture_count];
+	live_fixtures[k] = last;
+	fixture_live_slot[last - fixtures] = k;
+	live_fixtures_sorted = false;
+	fixture_free_push(fx_i);
 }
 
-void rand_pos_in_space(num *out_x, num *out_y) {
+void rand_pos_in_space(struct Rng *rng, num *out_x, num *out_y) {
 	bool done = false;
 	while (!done) {
 		const int g = 1000; // granularity of randomness
 		const num RANGE = DIM - 1;
-		num x = rand_int(g) * RANGE / g;
-		num y = rand_int(g) * RANGE / g;
+		num x = rand_int(rng, g) * RANGE / g;
+		num y = rand_int(rng, g) * RANGE / g;
 		*out_x = x;
 		*out_y = y;
 		done = true;
@@ -209,29 +555,116 @@ void rand_pos_in_space(num *out_x, num *out_y) {
 
 #define OBSTACLE_INITIAL 100
 
+void *world_array(void *p, size_t count, size_t size) {
+	p = realloc(p, max(count, 1) * size);
+	if (p == NULL) {
+		printf("ERROR: Out of memory for a world with --idim %lu\n", world_idim);
+		exit(1);
+	}
+	return p;
+}
+
+// Sizes everything that scales with the world. Capacities go up with its
+// area, as they did when IDIM was only a compile time option, but there is
+// always room for the characters asked for with --chars.
+void size_world() {
+	if (world_idim == 0 || world_idim > IDIM_CAP) {
+		printf("ERROR: --idim has to be from 1 to %d\n", IDIM_CAP);
+		exit(1);
+	}
+	DIM = world_idim * UNIT;
+	char_cap = max(world_idim * world_idim / 4, char_initial);
+	fixture_cap = world_idim * world_idim / 16;
+	item_initial = world_idim * world_idim / 64;
+	// chunk buffers are kept from one init() to the next, unless the
+	// chunks themselves change
+	size_t new_chunk_dim = 2 * DIM / CHUNK_SIZE + 1;
+	if (new_chunk_dim != chunk_dim) {
+		range (i, chunk_dim * chunk_dim) {
+			free(chunks[i].refs);
+			free(chunks[i].watchers.list);
+		}
+		chunk_dim = new_chunk_dim;
+		chunks = world_array(chunks, chunk_dim * chunk_dim, sizeof(struct Chunk));
+		range (i, chunk_dim * chunk_dim) {
+			chunks[i].refs = NULL;
+			chunks[i].cap = 0;
+			chunks[i].watchers.list = NULL;
+			chunks[i].watchers.cap = 0;
+		}
+	}
+
+	if (chunk_dim * chunk_dim * item_type_count != chunk_type_count) {
+		range (i, chunk_type_count) {
+			free(chunk_types[i].refs);
+			free(chunk_types[i].watchers.list);
+		}
+		chunk_type_count = chunk_dim * chunk_dim * item_type_count;
+		chunk_types = world_array(chunk_types, chunk_type_count, sizeof(struct TypeList));
+		range (i, chunk_type_count) {
+			chunk_types[i].refs = NULL;
+			chunk_types[i].cap = 0;
+			chunk_types[i].watchers.list = NULL;
+			chunk_types[i].watchers.cap = 0;
+		}
+	}
+
+	chars.x = world_array(chars.x, char_cap, sizeof(num));
+	chars.y = world_array(chars.y, char_cap, sizeof(num));
+	chars.velx = world_array(chars.velx, char_cap, sizeof(num));
+	chars.vely = world_array(chars.vely, char_cap, sizeof(num));
+	chars.nav = world_array(chars.nav, char_cap, sizeof(struct CharNav));
+	chars.craft = world_array(chars.craft, char_cap, sizeof(struct CharCraft));
+	chars.rng = world_array(chars.rng, char_cap, sizeof(struct Rng));
+	crossed = world_array(crossed, char_cap, sizeof(uint32_t));
+	crossed_from_x = world_array(crossed_from_x, char_cap, sizeof(uint32_t));
+	crossed_from_y = world_array(crossed_from_y, char_cap, sizeof(uint32_t));
+	route_requests = world_array(route_requests, char_cap, sizeof(uint32_t));
+	route_results = world_array(route_results, char_cap, sizeof(struct RouteResult));
+	fixtures = world_array(fixtures, fixture_cap, sizeof(struct Fixture));
+	live_fixtures = world_array(live_fixtures, fixture_cap, sizeof(Fixture));
+	fixture_live_slot = world_array(fixture_live_slot, fixture_cap, sizeof(uint32_t));
+	fixture_free = world_array(fixture_free, fixture_cap, sizeof(uint32_t));
+	char_chunk_slot = world_array(char_chunk_slot, char_cap, sizeof(uint32_t));
+	char_watch_epoch = world_array(char_watch_epoch, char_cap, sizeof(uint32_t));
+	fixture_chunk_slot = world_array(fixture_chunk_slot, fixture_cap, sizeof(uint32_t));
+}
+
 void init() {
+	if (pool.thread_count != sim_threads) {
+		pool_init(sim_threads);
+	}
+	size_world();
 	fixture_count = 0;
+	fixture_used = 0;
+	fixture_free_count = 0;
+	live_fixtures_sorted = true;
+	timers_clear(&item_timers);
+	timers_clear(&decide_timers);
+	timers_clear(&nav_timers);
 	char_count = 0;
-	range (i, CHUNK_DIM) {
-		range (j, CHUNK_DIM) {
-			chunks[i][j].total_num = 0;
-			range(k, CHUNK_BUFFER_SIZE) {
-				chunks[i][j].refs[k] = 0;
-			}
-		}
+	range (i, chunk_dim * chunk_dim) {
+		chunks[i].total_num = 0;
+		chunks[i].touched = 0;
+		chunks[i].watchers.count = 0;
+	}
+	range (i, chunk_type_count) {
+		chunk_types[i].count = 0;
+		chunk_types[i].watchers.count = 0;
 	}
 
 	obstacle_count = 0;
 
+	struct Rng obstacle_rng = rng_stream(world_seed, RNG_STREAM_OBSTACLES);
 	range (i, OBSTACLE_INITIAL) {
 		const int g = 1000; // granularity of randomness
 		const num SPACING = DIM/10;
 		const num RANGE = DIM/20;
-		num x = -DIM + i%10*2*SPACING + rand_int(g)*RANGE/g;
-		num y = -DIM + i*2*DIM/OBSTACLE_INITIAL + rand_int(g)*RANGE/g;
+		num x = -DIM + i%10*2*SPACING + rand_int(&obstacle_rng, g)*RANGE/g;
+		num y = -DIM + i*2*DIM/OBSTACLE_INITIAL + rand_int(&obstacle_rng, g)*RANGE/g;
 		num dx = DIM / 100;
 		num dy = DIM / 5;
-		if (rand() % 2) {
+		if (rng_next(&obstacle_rng) % 2) {
 			dx = DIM / 5;
 			dy = DIM / 100;
 		}
@@ -243,60 +676,202 @@ void init() {
 	}
 
 	initialize_nav_edges(-DIM, DIM, -DIM, DIM);
+	route_cache_clear();
+	path_arena_clear();
 
-	range (i, ITEM_INITIAL) {
+	struct Rng item_rng = rng_stream(world_seed, RNG_STREAM_ITEMS);
+	range (i, item_initial) {
 		const int g = 1000; // granularity of randomness
 		const num RANGE = DIM - 1;
 		struct Item it;
 		it.type = &item_types[i % item_type_count];
 		it.change_frame = it.type->live_frames;
 		num x, y;
-		rand_pos_in_space(&x, &y);
+		rand_pos_in_space(&item_rng, &x, &y);
 		create_fixture(x, y, it);
 	}
-	range (i, CHAR_INITIAL) {
-		rand_pos_in_space(&chars[i].x, &chars[i].y);
+	range (i, char_initial) {
+		chars.rng[i] = rng_stream(world_seed, RNG_STREAM_CHARS + i);
+		rand_pos_in_space(&chars.rng[i], &chars.x[i], &chars.y[i]);
 
-		chars[i].velx = 0;
-		chars[i].vely = 0;
-		chars[i].path_count = 0;
-		chars[i].next_nav_frame = -1;
-		chars[i].endx = chars[i].x;
-		chars[i].endy = chars[i].y;
+		chars.velx[i] = 0;
+		chars.vely[i] = 0;
+		// the arrays come from realloc, so start from zero as static
+		// storage used to, since sim_hash looks at every field
+		memset(&chars.nav[i], 0, sizeof(struct CharNav));
+		memset(&chars.craft[i], 0, sizeof(struct CharCraft));
+		chars.nav[i].path_count = 0;
+		chars.nav[i].next_nav_frame = -1;
+		char_watch_epoch[i] = 0;
+		timers_add(&decide_timers, frame, i);
+		chars.nav[i].endx = chars.x[i];
+		chars.nav[i].endy = chars.y[i];
 
-		chars[i].held_item.type = NULL;
-		chars[i].input_count = 0;
-		chars[i].goal = &recipes[i % recipe_count];
+		chars.craft[i].held_item.type = NULL;
+		chars.craft[i].input_count = 0;
+		chars.craft[i].goal = &recipes[i % recipe_count];
 		char_count++;
 		chunk_add_char(i);
 	}
-	printf("Spread %d characters, %d fixtures across %d chunks, highest was %d in one chunk\n", char_count, fixture_count, CHUNK_DIM*CHUNK_DIM, high_water);
+	printf("Spread %lu characters, %lu fixtures across %lu chunks, highest was %d in one chunk\n", char_count, fixture_count, chunk_dim*chunk_dim, high_water);
+}
+
+void ref_pos(ref r, num *x, num *y) {
+	if ((r & REF_SORT) == REF_CHAR) {
+		*x = chars.x[r & REF_IND];
+		*y = chars.y[r & REF_IND];
+	} else if ((r & REF_SORT) == REF_FIXTURE) {
+		*x = fixtures[r & REF_IND].x;
+		*y = fixtures[r & REF_IND].y;
+	} else {
+		printf("Chunk contained unknown ref %x\n", r);
+		exit(1);
+	}
+}
+
+// Where the kth ref in chunk di, dj comes in a scan of the whole square,
+// column by column, which is how ties between equally near refs are broken.
+uint64_t chunk_order(size_t di, size_t dj, size_t k) {
+	return (uint64_t)(di * chunk_dim + dj) << 32 | k;
+}
+
+#define FIND_K_CAP 64
+
+// Up to k of the refs within r of x, y that satisfy cond, nearest first,
+// into out, returning how many there were. who is passed through to cond,
+// e.g. the character doing the looking. If holding isn't NULL, only
+// fixtures holding that item type are considered, see chunk_types.
+//
+// Chunks are visited in square rings outwards from the one x, y is in, and
+// the search stops once everything in the next ring is further away than
+// the kth nearest so far, which near a crowd is after a ring or two rather
+// than the whole square of chunk_range.
+size_t find_k_nearest_holding(
+	num x, num y, num r, ItemType holding,
+	bool (*cond)(ref x, size_t who), size_t who,
+	ref *out, size_t k
+) {
+	STAT_INC(find_nearest);
+	k = min(k, FIND_K_CAP);
+	if (k == 0) {
+		return 0;
+	}
+	num out_qu[FIND_K_CAP];
+	uint64_t out_order[FIND_K_CAP];
+	size_t found = 0;
+
+	size_t cl, cr, cu, cd;
+	chunk_range(x, y, r, &cl, &cr, &cu, &cd);
+	long cx = get_chunk(max(min(x, DIM-1), 1-DIM));
+	long cy = get_chunk(max(min(y, DIM-1), 1-DIM));
+	long rings = max(max(cx - (long)cl, (long)cr - cx), max(cy - (long)cu, (long)cd - cy));
+	for (long ring = 0; ring <= rings; ring++) {
+		// how close anything outside the rings so far can be
+		num near = min(
+			min(x - ((cx - ring + 1) * (num)CHUNK_SIZE - DIM), (cx + ring) * (num)CHUNK_SIZE - DIM - x),
+			min(y - ((cy - ring + 1) * (num)CHUNK_SIZE - DIM), (cy + ring) * (num)CHUNK_SIZE - DIM - y)
+		);
+		near = max(near, 0);
+		num worst = found == k ? out_qu[k - 1] : r * r;
+		if (ring > 0 && worst < near * near) {
+			break;
+		}
+		for (long di = max(cx - ring, (long)cl); di <= min(cx + ring, (long)cr); di++) {
+			// the sides of the ring are whole columns, the rest just the ends
+			long step = di == cx - ring || di == cx + ring ? 1 : 2 * ring;
+			for (long dj = cy - ring; dj <= cy + ring; dj += step) {
+				if (dj < (long)cu || dj > (long)cd) {
+					continue;
+				}
+				struct Chunk *chunk = chunk_at(di, dj);
+				ref *refs = chunk->refs;
+				size_t count = chunk->total_num;
+				if (holding != NULL) {
+					struct TypeList *list = chunk_type_list(di, dj, holding);
+					refs = list->refs;
+					count = list->count;
+				}
+				range (c, count) {
+					ref it = refs[c];
+					if (!cond(it, who)) continue;
+					num itx, ity;
+					ref_pos(it, &itx, &ity);
+					num dx = itx - x;
+					num dy = ity - y;
+					num qu = dx*dx + dy*dy;
+					// as if found by a scan of chunk->refs
+					uint64_t order = chunk_order(di, dj,
+						holding == NULL ? c : fixture_chunk_slot[it & REF_IND]);
+					if (found < k) {
+						if (qu >= r * r) continue;
+						found += 1;
+					} else if (qu > out_qu[k - 1]
+						|| (qu == out_qu[k - 1] && order > out_order[k - 1])
+					) {
+						continue;
+					}
+					size_t j = found - 1;
+					while (j > 0 && (qu < out_qu[j - 1]
+						|| (qu == out_qu[j - 1] && order < out_order[j - 1]))
+					) {
+						out[j] = out[j - 1];
+						out_qu[j] = out_qu[j - 1];
+						out_order[j] = out_order[j - 1];
+						j -= 1;
+					}
+					out[j] = it;
+					out_qu[j] = qu;
+					out_order[j] = order;
+				}
+			}
+		}
+	}
+	return found;
 }
 
-ref find_nearest(num x, num y, num r, bool (*cond)(ref x)) {
-	size_t cl = get_chunk(max(x - r, 1-DIM));
-	size_t cr = get_chunk(min(x + r, DIM-1));
-	size_t cu = get_chunk(max(y - r, 1-DIM));
-	size_t cd = get_chunk(min(y + r, DIM-1));
+size_t find_k_nearest(
+	num x, num y, num r,
+	bool (*cond)(ref x, size_t who), size_t who,
+	ref *out, size_t k
+) {
+	return find_k_nearest_holding(x, y, r, NULL, cond, who, out, k);
+}
+
+ref find_nearest_holding(
+	num x, num y, num r, ItemType holding,
+	bool (*cond)(ref x, size_t who), size_t who
+) {
+	ref nearest;
+	if (find_k_nearest_holding(x, y, r, holding, cond, who, &nearest, 1) == 0) {
+		return -1;
+	}
+	return nearest;
+}
+
+ref find_nearest(
+	num x, num y, num r,
+	bool (*cond)(ref x, size_t who), size_t who
+) {
+	return find_nearest_holding(x, y, r, NULL, cond, who);
+}
+
+// find_nearest by scanning every chunk in range, to check it against
+ref find_nearest_scan(
+	num x, num y, num r,
+	bool (*cond)(ref x, size_t who), size_t who
+) {
+	size_t cl, cr, cu, cd;
+	chunk_range(x, y, r, &cl, &cr, &cu, &cd);
 	ref nearest = -1;
-	long nearestqu = r * r;
-	for (int di = cl; di <= cr; di++) {
-		for (int dj = cu; dj <= cd; dj++) {
-			struct Chunk *chunk = &chunks[di][dj];
+	num nearestqu = r * r;
+	for (size_t di = cl; di <= cr; di++) {
+		for (size_t dj = cu; dj <= cd; dj++) {
+			struct Chunk *chunk = chunk_at(di, dj);
 			range(k, chunk->total_num) {
 				ref r = chunk->refs[k];
-				if (!cond(r)) continue;
+				if (!cond(r, who)) continue;
 				num itx, ity;
-				if ((r & REF_SORT) == REF_CHAR) {
-					itx = chars[r & REF_IND].x;
-					ity = chars[r & REF_IND].y;
-				} else if ((r & REF_SORT) == REF_FIXTURE) {
-					itx = fixtures[r & REF_IND].x;
-					ity = fixtures[r & REF_IND].y;
-				} else {
-					printf("Chunk contained unknown ref %x\n", r);
-					exit(1);
-				}
+				ref_pos(r, &itx, &ity);
 				num dx = itx - x;
 				num dy = ity - y;
 				num qu = dx*dx + dy*dy;
@@ -310,24 +885,23 @@ ref find_nearest(num x, num y, num r, bool (*cond)(ref x)) {
 	return nearest;
 }
 
-bool is_char(ref x) { return (x & REF_SORT) == REF_CHAR; }
-bool is_fixture(ref x) { return (x & REF_SORT) == REF_FIXTURE; }
+bool is_char(ref x, size_t who) { return (x & REF_SORT) == REF_CHAR; }
+bool is_fixture(ref x, size_t who) { return (x & REF_SORT) == REF_FIXTURE; }
 
-size_t is_valid_input_current_char;
-bool is_valid_input(ref x) {
-	size_t i = is_valid_input_current_char;
+// whether x holds the next input character i needs
+bool is_valid_input(ref x, size_t i) {
 	if ((x & REF_SORT) != REF_FIXTURE) {
 		return false;
 	}
 	x &= REF_IND;
 	Fixture it = &fixtures[x];
-	size_t input_count = chars[i].input_count;
+	size_t input_count = chars.craft[i].input_count;
 	range (inp, input_count) {
-		if (chars[i].inputs[inp] == x) {
+		if (chars.craft[i].inputs[inp] == x) {
 			return false;
 		}
 	}
-	ItemType goal = chars[i].goal->inputs[input_count];
+	ItemType goal = chars.craft[i].goal->inputs[input_count];
 	range(i, it->storage_count) {
 		if (it->storage[i].type == goal) {
 			return true;
@@ -336,274 +910,643 @@ bool is_valid_input(ref x) {
 	return false;
 }
 
-void simulate() {
-	// item evolution
-	range (i, char_count) {
-		Item it = &chars[i].held_item;
-		if (it->type != NULL && 0 <= it->change_frame && it->change_frame <= frame)
-		{
-			ItemType into = it->type->turns_into;
-			if (into == NULL || into->live_frames == -1) {
-				it->change_frame = -1;
+// Decisions are made in two steps: decide_plan() looks at the world and
+// works out what a character wants to do without changing anything, and
+// decide_apply() does it. Planning is where the time goes, so with more
+// than one thread every character is planned in parallel up front, then
+// the plans are applied in character order. A plan is only kept if nothing
+// it looked at has been touched by an earlier character in that order,
+// otherwise the character plans again there and then, so the outcome is
+// exactly that of planning and applying one character at a time: when two
+// characters go for the same fixture the lower index gets it and the other
+// picks again.
+enum DecisionKind {
+	DECIDE_NOTHING,
+	DECIDE_DROP, // put the held item down where we stand
+	DECIDE_DEPOSIT, // put the held item down as the next recipe input
+	DECIDE_WALK, // walk to x, y
+	DECIDE_CLAIM, // target fixture becomes the first input and craft site
+	DECIDE_PICK_UP, // take the next input out of the target fixture
+	DECIDE_ABANDON, // input number arg went missing, forget it and the rest
+	DECIDE_CRAFT, // consume the inputs and make the outputs
+};
+
+// what a plan looked at in the world, to know when it has gone stale
+enum DecisionReads {
+	READS_OWN_STATE,
+	READS_SEARCH, // every chunk within AWARENESS
+	READS_INPUTS, // the fixtures in the character's inputs
+};
+
+struct Decision {
+	uint8_t kind;
+	uint8_t reads;
+	uint32_t arg; // target fixture, or input number
+	num x, y;
+} *decisions;
+size_t decision_cap;
+
+struct Decision decide_plan(size_t i) {
+	struct Decision d = {DECIDE_NOTHING, READS_OWN_STATE, 0, 0, 0};
+	// only make decisions when not currently walking somewhere
+	// @Polish keep track of target item to see if goal has been
+	// undermined? eventually there will be explicit rules for tracking and
+	// locating though, maybe just keep it as is until then
+	if (chars.nav[i].next_nav_frame >= 0) {
+		return d;
+	}
+	struct CharCraft *c = &chars.craft[i];
+	Recipe goal = c->goal;
+	if (goal == NULL) {
+		return d;
+	}
+	if (goal->input_count == 0) {
+		printf("Recipes without inputs currently not supported\n");
+		exit(1);
+	} else if (c->held_item.type != NULL) {
+		if (c->input_count == 0
+			|| c->input_count >= goal->input_count
+			|| goal->inputs[c->input_count] != c->held_item.type
+		) {
+			d.kind = DECIDE_DROP;
+		} else {
+			num dx = c->craft_x - chars.x[i];
+			num dy = c->craft_y - chars.y[i];
+			num qu = dx * dx + dy * dy;
+			if (qu < REACH * REACH) {
+				d.kind = DECIDE_DEPOSIT;
 			} else {
-				it->change_frame += it->type->live_frames;
+				d.kind = DECIDE_WALK;
+				d.x = c->craft_x;
+				d.y = c->craft_y;
 			}
-			it->type = into;
 		}
-	}
-	range (i, fixture_count) {
-		Fixture fx = live_fixtures[i];
-		range (j, fx->storage_count) {
-			Item it = &fx->storage[j];
-			if (it->type != NULL && 0 <= it->change_frame && it->change_frame <= frame)
-			{
-				ItemType into = it->type->turns_into;
-				if (into == NULL) {
-					fx->storage[j] = fx->storage[fx->storage_count - 1];
-					fx->storage_count -= 1;
-					j -= 1;
-				} else if (into->live_frames = -1) {
-					it->change_frame = -1;
-				} else {
-					it->change_frame += it->type->live_frames;
-				}
-				it->type = into;
+	} else if (c->input_count < goal->input_count) {
+		d.reads = READS_SEARCH;
+		ref target = find_nearest_holding(chars.x[i], chars.y[i], AWARENESS,
+			goal->inputs[c->input_count], is_valid_input, i);
+		if (target == -1) {
+			return d;
+		}
+		target &= REF_IND;
+		Fixture fx = &fixtures[target];
+		num dx = fx->x - chars.x[i];
+		num dy = fx->y - chars.y[i];
+		num qu = dx * dx + dy * dy;
+		d.arg = target;
+		if (qu < REACH * REACH || (c->input_count == 0 && goal->input_count > 1)) {
+			d.kind = c->input_count == 0 ? DECIDE_CLAIM : DECIDE_PICK_UP;
+		} else {
+			d.kind = DECIDE_WALK;
+			d.x = fx->x;
+			d.y = fx->y;
+		}
+	} else {
+		d.reads = READS_INPUTS;
+		range(inp, c->input_count) {
+			Fixture fx = &fixtures[c->inputs[inp]];
+			num dx = fx->x - c->craft_x;
+			num dy = fx->y - c->craft_y;
+			num qu = dx * dx + dy * dy;
+			if (
+				fx->type != FIXTURE_CLUTTER
+				|| fx->storage_count == 0
+				|| fx->storage[0].type != goal->inputs[inp]
+				|| qu > REACH * REACH
+			) {
+				d.kind = DECIDE_ABANDON;
+				d.arg = inp;
+				return d;
 			}
 		}
-		if (fx->type == FIXTURE_CLUTTER && fx->storage_count == 0) {
-			destroy_fixture(fx - fixtures);
-			i -= 1;
+		if (frame >= c->craft_t) {
+			d.kind = DECIDE_CRAFT;
 		}
 	}
+	return d;
+}
 
-	// decision making
-	range (i, char_count) {
-		// only make decisions when not currently walking somewhere
-		// @Polish keep track of target item to see if goal has been
-		// undermined? eventually there will be explicit rules for tracking and
-		// locating though, maybe just keep it as is until then
-		if (chars[i].next_nav_frame >= 0) {
-			continue;
+void decide_apply(size_t i, struct Decision d) {
+	struct CharCraft *c = &chars.craft[i];
+	Recipe goal = c->goal;
+	switch (d.kind) {
+	case DECIDE_NOTHING:
+		break;
+	case DECIDE_DROP:
+		create_fixture(chars.x[i], chars.y[i], c->held_item);
+		c->held_item.type = NULL;
+		c->held_item.change_frame = -1;
+		break;
+	case DECIDE_DEPOSIT: {
+		long it = create_fixture(chars.x[i], chars.y[i], c->held_item);
+		c->held_item.type = NULL;
+		c->held_item.change_frame = -1;
+		bool stolen = false;
+		range (j, c->input_count - 1) {
+			if (c->inputs[j] == it) {
+				// the loop bound changes under us, so stop here
+				c->input_count = j;
+				stolen = true;
+				break;
+			}
 		}
-		Recipe goal = chars[i].goal;
-		if (goal == NULL) {
-			continue;
+		if (!stolen) {
+			c->inputs[c->input_count] = it;
+			c->input_count += 1;
+			c->craft_t = frame + goal->duration;
+		}
+		break;
+	}
+	case DECIDE_WALK:
+		chars.nav[i].endx = d.x;
+		chars.nav[i].endy = d.y;
+		nav_continue_at(i, frame);
+		break;
+	case DECIDE_CLAIM: {
+		Fixture fx = &fixtures[d.arg];
+		c->inputs[c->input_count] = d.arg;
+		c->input_count += 1;
+		c->craft_x = fx->x;
+		c->craft_y = fx->y;
+		c->craft_t = frame + goal->duration;
+		break;
+	}
+	case DECIDE_PICK_UP: {
+		Fixture fx = &fixtures[d.arg];
+		bool worked = false;
+		range(j, fx->storage_count) {
+			if (fx->storage[j].type != goal->inputs[c->input_count]) {
+				continue;
+			}
+			c->held_item = fixture_take(d.arg, j);
+			item_timer_add(i | REF_CHAR, c->held_item);
+			touch_fixture(d.arg);
+			if (fx->type == FIXTURE_CLUTTER && fx->storage_count == 0) {
+				destroy_fixture(d.arg);
+			}
+			worked = true;
+			break;
 		}
-		if (goal->input_count == 0) {
-			printf("Recipes without inputs currently not supported\n");
+		if (!worked) {
+			printf("Chosen fixture did not contain desired item?\n");
 			exit(1);
-		} else if (chars[i].held_item.type != NULL) {
-			if (chars[i].input_count == 0
-				|| chars[i].input_count >= goal->input_count
-				|| goal->inputs[chars[i].input_count] != chars[i].held_item.type
-			) {
-				create_fixture(chars[i].x, chars[i].y, chars[i].held_item);
-				chars[i].held_item.type = NULL;
-				chars[i].held_item.change_frame = -1;
+		}
+		break;
+	}
+	case DECIDE_ABANDON:
+		c->input_count = d.arg;
+		break;
+	case DECIDE_CRAFT:
+		range(inp, c->input_count) {
+			destroy_fixture(c->inputs[inp]);
+		}
+		c->input_count = 0;
+		range(out, goal->output_count) {
+			struct Item it;
+			it.type = goal->outputs[out];
+			int live_frames = goal->outputs[out]->live_frames;
+			if (live_frames == -1) {
+				it.change_frame = -1;
 			} else {
-				num dx = chars[i].craft_x - chars[i].x;
-				num dy = chars[i].craft_y - chars[i].y;
-				num qu = dx * dx + dy * dy;
-				if (qu < REACH * REACH) {
-					long it = create_fixture(chars[i].x, chars[i].y, chars[i].held_item);
-					chars[i].held_item.type = NULL;
-					chars[i].held_item.change_frame = -1;
-					bool stolen = false;
-					range (j, chars[i].input_count - 1) {
-						if (chars[i].inputs[j] == it) {
-							chars[i].input_count = j;
-							stolen = true;
-						}
-					}
-					if (!stolen) {
-						chars[i].inputs[chars[i].input_count] = it;
-						chars[i].input_count += 1;
-						chars[i].craft_t = frame + goal->duration;
-					}
-				} else {
-					chars[i].endx = chars[i].craft_x;
-					chars[i].endy = chars[i].craft_y;
-					chars[i].next_nav_frame = frame;
+				it.change_frame = frame + live_frames;
+			}
+			create_fixture(c->craft_x, c->craft_y, it);
+		}
+		break;
+	}
+}
+
+bool decision_still_valid(size_t i, struct Decision *d) {
+	if (d->reads == READS_SEARCH) {
+		size_t cl, cr, cu, cd;
+		chunk_range(chars.x[i], chars.y[i], AWARENESS, &cl, &cr, &cu, &cd);
+		for (size_t di = cl; di <= cr; di++) {
+			for (size_t dj = cu; dj <= cd; dj++) {
+				if (chunk_at(di, dj)->touched == touch_epoch) {
+					return false;
 				}
 			}
-		} else if (chars[i].input_count < goal->input_count) {
-			is_valid_input_current_char = i;
-			ref target = find_nearest(chars[i].x, chars[i].y, AWARENESS, is_valid_input);
-			if (target == -1) {
+		}
+	} else if (d->reads == READS_INPUTS) {
+		struct CharCraft *c = &chars.craft[i];
+		range (inp, c->input_count) {
+			if (fixtures[c->inputs[inp]].touched == touch_epoch) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// When character i next needs deciding for, now that it has had d applied.
+// Anything left out here only changes through an event that wakes it.
+void decide_schedule(size_t i, struct Decision d) {
+	struct CharCraft *c = &chars.craft[i];
+	if (chars.nav[i].next_nav_frame >= 0 || c->goal == NULL) {
+		// navigation wakes it when it stops
+		return;
+	}
+	if (d.kind == DECIDE_NOTHING && d.reads == READS_INPUTS) {
+		// waiting for craft_t, unless one of the inputs changes first
+		char_watch_epoch[i] += 1;
+		range (inp, c->input_count) {
+			Fixture fx = &fixtures[c->inputs[inp]];
+			watchers_add(&chunk_at(get_chunk(fx->x), get_chunk(fx->y))->watchers, i);
+		}
+		timers_add(&decide_timers, c->craft_t, i);
+		return;
+	}
+	if (d.kind == DECIDE_NOTHING && d.reads == READS_SEARCH) {
+		// nothing to be found, and it stays where it is until something of
+		// the type it wants turns up within reach
+		char_watch_epoch[i] += 1;
+		ItemType want = c->goal->inputs[c->input_count];
+		size_t cl, cr, cu, cd;
+		chunk_range(chars.x[i], chars.y[i], AWARENESS, &cl, &cr, &cu, &cd);
+		for (size_t di = cl; di <= cr; di++) {
+			for (size_t dj = cu; dj <= cd; dj++) {
+				watchers_add(&chunk_type_list(di, dj, want)->watchers, i);
+			}
+		}
+		return;
+	}
+	timers_add(&decide_timers, frame + 1, i);
+}
+
+void decide_plan_range(size_t begin, size_t end, size_t worker) {
+	for (size_t k = begin; k < end; k++) {
+		decisions[k] = decide_plan(decide_timers.due[k]);
+	}
+}
+
+// Decides for every character due, in index order. With threads, those due
+// at the start are planned in parallel first. Characters woken by an
+// earlier one's decision join in as the loop gets to them, and are planned
+// there and then.
+void decide_all() {
+	size_t due = timers_pop_due(&decide_timers, frame);
+	bool planned = pool.thread_count > 1;
+	if (planned) {
+		// only needed with threads, so it's sized here rather than by size_world
+		if (decision_cap < char_cap) {
+			decision_cap = char_cap;
+			decisions = world_array(decisions, decision_cap, sizeof(struct Decision));
+		}
+		pool_run(decide_plan_range, due);
+		// anything touched from here on was touched after planning
+		touch_epoch += 1;
+	}
+	size_t k = 0;
+	while (true) {
+		struct Timers *t = &decide_timers;
+		bool woken = t->count > 0 && t->heap[0].frame <= frame
+			&& (k == due || t->heap[0].owner < t->due[k]);
+		size_t i;
+		struct Decision d;
+		if (woken) {
+			i = timers_pop(t).owner;
+			if ((long)i <= decide_cursor) {
 				continue;
 			}
-			target &= REF_IND;
-			num dx = fixtures[target].x - chars[i].x;
-			num dy = fixtures[target].y - chars[i].y;
-			num qu = dx * dx + dy * dy;
-			Fixture fx = &fixtures[target];
-			if (qu < REACH * REACH || (chars[i].input_count == 0 && goal->input_count > 1)) {
-				if (chars[i].input_count == 0) {
-					chars[i].inputs[chars[i].input_count] = target;
-					chars[i].input_count += 1;
-					chars[i].craft_x = fx->x;
-					chars[i].craft_y = fx->y;
-					chars[i].craft_t = frame + goal->duration;
-				} else {
-					bool worked = false;
-					range(j, fx->storage_count) {
-						if (fx->storage[j].type != goal->inputs[chars[i].input_count]) {
-							continue;
-						}
-						chars[i].held_item = fx->storage[j];
-						fx->storage[j] = fx->storage[fx->storage_count - 1];
-						fx->storage_count -= 1;
-						if (fx->type == FIXTURE_CLUTTER && fx->storage_count == 0) {
-							destroy_fixture(target);
-						}
-						worked = true;
-						break;
-					}
-					if (!worked) {
-						printf("Chosen fixture did not contain desired item?\n");
-						exit(1);
-					}
+			d = decide_plan(i);
+		} else if (k < due) {
+			i = t->due[k];
+			if (planned) {
+				d = decisions[k];
+				if (!decision_still_valid(i, &d)) {
+					d = decide_plan(i);
 				}
 			} else {
-				chars[i].endx = fixtures[target].x;
-				chars[i].endy = fixtures[target].y;
-				chars[i].next_nav_frame = frame;
+				d = decide_plan(i);
 			}
+			k += 1;
 		} else {
-			bool stolen = false;
-			range(inp, chars[i].input_count) {
-				Fixture fx = &fixtures[chars[i].inputs[inp]];
-				num dx = fx->x - chars[i].craft_x;
-				num dy = fx->y - chars[i].craft_y;
-				num qu = dx * dx + dy * dy;
-				if (
-					fx->type != FIXTURE_CLUTTER
-					|| fx->storage_count == 0
-					|| fx->storage[0].type != goal->inputs[inp]
-					|| qu > REACH * REACH
-				) {
-					stolen = true;
-					chars[i].input_count = inp;
-					break;
+			break;
+		}
+		STAT_INC(decided);
+		decide_cursor = i;
+		decide_apply(i, d);
+		decide_schedule(i, d);
+	}
+	decide_cursor = LONG_MAX;
+}
+
+void route_range(size_t begin, size_t end, size_t worker) {
+	struct RouteOutput *out = &route_outputs[worker];
+	for (size_t k = begin; k < end; k++) {
+		size_t i = route_requests[k];
+		struct RouteResult *result = &route_results[i];
+		result->obstructed = interval_obstructed(
+			chars.x[i], chars.y[i],
+			chars.nav[i].endx, chars.nav[i].endy
+		);
+		result->path_count = 0;
+		if (result->obstructed) {
+			size_t count;
+			pick_route_cached(
+				&route_scratch[worker],
+				chars.x[i], chars.y[i], chars.nav[i].endx, chars.nav[i].endy,
+				&count, route_paths[worker]
+			);
+			if (out->count + count > out->cap) {
+				out->cap = max(2 * out->cap, max(out->count + count, 256));
+				out->nodes = realloc(out->nodes, out->cap * sizeof(uint32_t));
+				if (out->nodes == NULL) {
+					printf("ERROR: Out of memory for routes\n");
+					exit(1);
 				}
 			}
-			if (!stolen && frame >= chars[i].craft_t) {
-				range(inp, chars[i].input_count) {
-					destroy_fixture(chars[i].inputs[inp]);
-				}
-				chars[i].input_count = 0;
-				range(out, goal->output_count) {
-					long j = 0;
-					struct Item it;
-					it.type = goal->outputs[out];
-					int live_frames = goal->outputs[out]->live_frames;
-					if (live_frames == -1) {
-						it.change_frame = -1;
-					} else {
-						it.change_frame = frame + live_frames;
-					}
-					create_fixture(chars[i].craft_x, chars[i].craft_y, it);
-				}
+			range (m, count) {
+				out->nodes[out->count + m] = route_paths[worker][m].i;
 			}
+			result->path_count = count;
+			result->worker = worker;
+			result->offset = out->count;
+			out->count += count;
+		}
+	}
+}
+
+// next node on the path, path_count has to be more than 0
+nav char_path_next(struct CharNav *n) {
+	return (nav){path_arena.nodes[n->path_start + n->path_count - 1]};
+}
+
+// An item's change_frame has come, it turns into the next type along, or
+// into nothing.
+bool item_due(struct Item *it) {
+	return it->type != NULL && 0 <= it->change_frame && it->change_frame <= frame;
+}
+
+void item_evolve(struct Item *it) {
+	ItemType into = it->type->turns_into;
+	if (into == NULL || into->live_frames == -1) {
+		it->change_frame = -1;
+	} else {
+		it->change_frame += into->live_frames;
+	}
+	it->type = into;
+}
+
+void evolve_held_item(size_t i) {
+	Item it = &chars.craft[i].held_item;
+	if (item_due(it)) {
+		item_evolve(it);
+		item_timer_add(i | REF_CHAR, *it);
+	}
+}
+
+void evolve_stored_items(size_t f) {
+	Fixture fx = &fixtures[f];
+	if (fx->type == NULL) {
+		return;
+	}
+	range (j, fx->storage_count) {
+		Item it = &fx->storage[j];
+		if (!item_due(it)) {
+			continue;
 		}
+		if (it->type->turns_into == NULL) {
+			fixture_take(f, j);
+			j -= 1;
+			continue;
+		}
+		fixture_index_remove(f, j);
+		item_evolve(it);
+		fixture_index_add(f, j);
+		item_timer_add(f | REF_FIXTURE, *it);
+	}
+	// it might be someone's recipe input
+	watchers_wake(&chunk_at(get_chunk(fx->x), get_chunk(fx->y))->watchers);
+	if (fx->type == FIXTURE_CLUTTER && fx->storage_count == 0) {
+		destroy_fixture(f);
 	}
+}
+
+void simulate() {
+	// item evolution
+	STAT_PHASE_BEGIN(PHASE_ITEMS);
+	decide_cursor = -1;
+	size_t due = timers_pop_due(&item_timers, frame);
+	range (k, due) {
+		ref owner = item_timers.due[k];
+		if ((owner & REF_SORT) == REF_CHAR) {
+			evolve_held_item(owner & REF_IND);
+		} else {
+			evolve_stored_items(owner & REF_IND);
+		}
+	}
+	STAT_PHASE_END(PHASE_ITEMS);
+
+	// decision making
+	STAT_PHASE_BEGIN(PHASE_DECISIONS);
+	decide_all();
+	STAT_PHASE_END(PHASE_DECISIONS);
 
 	// navigation
-	range (i, char_count) {
-		if (chars[i].next_nav_frame < 0 || frame < chars[i].next_nav_frame) {
+	STAT_PHASE_BEGIN(PHASE_NAVIGATION);
+	route_request_count = 0;
+	size_t nav_due = timers_pop_due(&nav_timers, frame);
+	range (k, nav_due) {
+		size_t i = nav_timers.due[k];
+		struct CharNav *n = &chars.nav[i];
+		if (n->next_nav_frame < 0 || frame < n->next_nav_frame) {
+			continue;
+		}
+		if (n->path_count == 0 && chars.velx[i] == 0 && chars.vely[i] == 0
+			&& (chars.x[i] != n->endx || chars.y[i] != n->endy)
+		) {
+			route_requests[route_request_count] = i;
+			route_request_count += 1;
+		}
+	}
+	range (w, POOL_THREAD_CAP) {
+		route_outputs[w].count = 0;
+	}
+	pool_run(route_range, route_request_count);
+	route_cache_end_batch();
+	range (k, nav_due) {
+		size_t i = nav_timers.due[k];
+		struct CharNav *n = &chars.nav[i];
+		if (n->next_nav_frame < 0 || frame < n->next_nav_frame) {
 			continue;
 		}
+		STAT_INC(navigated);
 		bool nextpos_chosen = false;
 		num nextx;
 		num nexty;
-		if (chars[i].path_count == 0) {
-			if (chars[i].velx == 0 && chars[i].vely == 0) {
-				if (chars[i].x == chars[i].endx && chars[i].y == chars[i].endy) {
-					chars[i].next_nav_frame = -1;
-				} else if (interval_obstructed(
-					chars[i].x, chars[i].y,
-					chars[i].endx, chars[i].endy
-				)) {
-					pick_route(
-						chars[i].x, chars[i].y, chars[i].endx, chars[i].endy,
-						&chars[i].path_count, char_paths[i]
-					);
-					if (chars[i].path_count == 0) {
-						chars[i].next_nav_frame = -1;
+		if (n->path_count == 0) {
+			if (chars.velx[i] == 0 && chars.vely[i] == 0) {
+				if (chars.x[i] == n->endx && chars.y[i] == n->endy) {
+					nav_stop(i);
+				} else if (route_results[i].obstructed) {
+					struct RouteResult *result = &route_results[i];
+					n->path_count = result->path_count;
+					if (n->path_count == 0) {
+						nav_stop(i);
 					} else {
-						nav next = char_paths[i][chars[i].path_count - 1];
+						n->path_start = path_alloc(n->path_count, &n->path_class);
+						memcpy(&path_arena.nodes[n->path_start],
+							&route_outputs[result->worker].nodes[result->offset],
+							n->path_count * sizeof(uint32_t));
+						nav next = char_path_next(n);
 						nextx = nav_nodes[next.i].x;
 						nexty = nav_nodes[next.i].y;
 						nextpos_chosen = true;
 					}
 				} else {
-					nextx = chars[i].endx;
-					nexty = chars[i].endy;
+					nextx = n->endx;
+					nexty = n->endy;
 					nextpos_chosen = true;
 				}
 			} else {
-				chars[i].endx = chars[i].x;
-				chars[i].endy = chars[i].y;
-				chars[i].velx = 0;
-				chars[i].vely = 0;
-				chars[i].next_nav_frame = -1;
+				n->endx = chars.x[i];
+				n->endy = chars.y[i];
+				chars.velx[i] = 0;
+				chars.vely[i] = 0;
+				nav_stop(i);
 			}
 		} else {
-			nav curr = char_paths[i][chars[i].path_count - 1];
-			chars[i].path_count -= 1;
+			nav curr = char_path_next(n);
+			n->path_count -= 1;
+			if (n->path_count == 0) {
+				path_free(n->path_start, n->path_class);
+			}
+			STAT_INC(chunk_moves);
 			chunk_remove_char(i);
-			chars[i].x = nav_nodes[curr.i].x;
-			chars[i].y = nav_nodes[curr.i].y;
+			chars.x[i] = nav_nodes[curr.i].x;
+			chars.y[i] = nav_nodes[curr.i].y;
 			chunk_add_char(i);
-			if (chars[i].path_count == 0) {
-				nextx = chars[i].endx;
-				nexty = chars[i].endy;
+			if (n->path_count == 0) {
+				nextx = n->endx;
+				nexty = n->endy;
 			} else {
-				nav next = char_paths[i][chars[i].path_count - 1];
+				nav next = char_path_next(n);
 				nextx = nav_nodes[next.i].x;
 				nexty = nav_nodes[next.i].y;
 			}
 			nextpos_chosen = true;
 		}
 		if (nextpos_chosen) {
-			num dx = nextx - chars[i].x;
-			num dy = nexty - chars[i].y;
-			num qu = (dx*dx+dy*dy)/UNIT;
-			num scale = invsqrt_nr(qu);
-			num dist = qu*scale/UNIT;
+			num dx = nextx - chars.x[i];
+			num dy = nexty - chars.y[i];
+			num dist = fx_hypot(dx, dy);
 			const num SPEED = UNIT/4;
-			chars[i].velx = dx*scale/UNIT*SPEED/UNIT;
-			chars[i].vely = dy*scale/UNIT*SPEED/UNIT;
-			chars[i].next_nav_frame = frame + dist / SPEED;
+			chars.velx[i] = dx*SPEED/max(dist, 1);
+			chars.vely[i] = dy*SPEED/max(dist, 1);
+			nav_continue_at(i, frame + dist / SPEED);
 		}
 	}
+	STAT_PHASE_END(PHASE_NAVIGATION);
 
 	// movement
+	STAT_PHASE_BEGIN(PHASE_MOVEMENT);
+	size_t crossed_count = move_kernel(
+		chars.x, chars.y, chars.velx, chars.vely, char_count,
+		1-DIM, DIM-1, DIM, CHUNK_SHIFT,
+		crossed, crossed_from_x, crossed_from_y
+	);
+	range (k, crossed_count) {
+		STAT_INC(chunk_moves);
+		chunk_remove_char_from(crossed[k], crossed_from_x[k], crossed_from_y[k]);
+		chunk_add_char(crossed[k]);
+	}
+	STAT_PHASE_END(PHASE_MOVEMENT);
+
+	STAT_END_FRAME();
+}
+
+// Hash of everything that evolves during simulate(), for checking that two
+// runs took the same trajectory. Pointers are hashed as table indices so the
+// result does not depend on where things were loaded.
+uint64_t hash_word(uint64_t h, uint64_t v) {
+	return mix64(h ^ (v + 0x9e3779b97f4a7c15ULL));
+}
+
+uint64_t hash_item(uint64_t h, struct Item it) {
+	h = hash_word(h, it.type ? it.type - item_types : -1);
+	return hash_word(h, it.change_frame);
+}
+
+uint64_t sim_hash() {
+	uint64_t h = hash_word(0, frame);
+	h = hash_word(h, char_count);
 	range (i, char_count) {
-		num x = chars[i].x;
-		num y = chars[i].y;
-		num newx = x + chars[i].velx;
-		num newy = y + chars[i].vely;
-		bool same_chunk = get_chunk(x) == get_chunk(newx)
-			&& get_chunk(y) == get_chunk(newy);
-		if (!same_chunk) {
-			chunk_remove_char(i);
-			if (newx >= DIM) {
-				newx = DIM-1;
-			} else if (newx <= -DIM) {
-				newx = -DIM+1;
-			}
-			if (newy >= DIM) {
-				newy = DIM-1;
-			} else if (newy <= -DIM) {
-				newy = -DIM+1;
-			}
+		struct CharCraft *c = &chars.craft[i];
+		struct CharNav *n = &chars.nav[i];
+		h = hash_word(h, c->goal ? c->goal - recipes : -1);
+		h = hash_word(h, c->craft_x);
+		h = hash_word(h, c->craft_y);
+		h = hash_word(h, c->craft_t);
+		h = hash_word(h, c->input_count);
+		range (inp, c->input_count) {
+			h = hash_word(h, c->inputs[inp]);
 		}
-		chars[i].x = newx;
-		chars[i].y = newy;
-		if (!same_chunk) {
-			chunk_add_char(i);
+		h = hash_item(h, c->held_item);
+		h = hash_word(h, chars.x[i]);
+		h = hash_word(h, chars.y[i]);
+		h = hash_word(h, chars.velx[i]);
+		h = hash_word(h, chars.vely[i]);
+		h = hash_word(h, n->path_count);
+		h = hash_word(h, n->next_nav_frame);
+		h = hash_word(h, n->endx);
+		h = hash_word(h, n->endy);
+	}
+	h = hash_word(h, fixture_count);
+	sort_live_fixtures();
+	range (i, fixture_count) {
+		Fixture fx = live_fixtures[i];
+		h = hash_word(h, fx - fixtures);
+		h = hash_word(h, fx->x);
+		h = hash_word(h, fx->y);
+		h = hash_word(h, fx->storage_count);
+		range (j, fx->storage_count) {
+			h = hash_item(h, fx->storage[j]);
 		}
 	}
+	return h;
+}
+
+// Options shared by every entry point. Returns true if argv[*i] was one of
+// them, leaving *i on the last argument consumed.
+bool sim_option(int argc, char **argv, int *i) {
+	if (strcmp(argv[*i], "--seed") == 0 && *i + 1 < argc) {
+		*i += 1;
+		world_seed = strtoull(argv[*i], NULL, 0);
+		return true;
+	}
+	if (strcmp(argv[*i], "--chars") == 0 && *i + 1 < argc) {
+		*i += 1;
+		char_initial = strtoul(argv[*i], NULL, 0);
+		return true;
+	}
+	if (strcmp(argv[*i], "--fixture-order") == 0 && *i + 1 < argc) {
+		*i += 1;
+		if (strcmp(argv[*i], "dense") == 0) {
+			fixture_order = FIXTURE_ORDER_DENSE;
+		} else if (strcmp(argv[*i], "sorted") == 0) {
+			fixture_order = FIXTURE_ORDER_SORTED;
+		} else {
+			printf("ERROR: --fixture-order is dense or sorted\n");
+			exit(1);
+		}
+		return true;
+	}
+	if (strcmp(argv[*i], "--idim") == 0 && *i + 1 < argc) {
+		*i += 1;
+		world_idim = strtoul(argv[*i], NULL, 0);
+		return true;
+	}
+	if (strcmp(argv[*i], "--threads") == 0 && *i + 1 < argc) {
+		*i += 1;
+		sim_threads = strtoul(argv[*i], NULL, 0);
+		return true;
+	}
+	if (strcmp(argv[*i], "--route-cache-mb") == 0 && *i + 1 < argc) {
+		*i += 1;
+		route_cache.cap_bytes = strtoul(argv[*i], NULL, 0) << 20;
+		return true;
+	}
+	return false;
 }
 
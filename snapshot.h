@@ -0,0 +1,952 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "data.h"
+#include "sim.h"
+
+// Binary snapshots of a whole world, so that it can be saved while it runs
+// and picked up again later without parse_data() or init().
+//
+// A snapshot is a SnapHeader followed by sections, each a SnapSectionHeader
+// and then its bytes, padded to 8, always in the order snapshot_save writes
+// them. Arrays with no pointers in them are written as they are in memory,
+// in the byte order and layout of the machine that wrote them. Anything
+// holding an ItemType, FixtureType, Recipe or Fixture pointer is written as
+// a Snap record instead, with the pointer turned into an index into its
+// table, and turned back on load. The item, fixture type and recipe tables
+// are saved along with the world, so a snapshot doesn't depend on data.txt
+// staying the same.
+//
+// Loading maps the file and copies each section straight into the arrays
+// size_world() sets up, so it costs about as much as reading the file once.
+// The obstacle grid, the chunk slot back-indices and live_fixtures pointers
+// are quick to rebuild and aren't saved. The route cache starts out empty,
+// but which nodes have missed it is saved, since that decides whether a
+// route comes from a tree or from A*.
+//
+// snapshot_checkpoint writes from a forked child, which gets a copy of the
+// world as it was between two frames, so the simulation only stops for as
+// long as fork() takes.
+
+#define SNAPSHOT_VERSION 2
+#define SNAP_NONE (-1)
+
+struct SnapHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order; // 0x01020304 as written
+	uint64_t world_seed;
+	uint64_t world_idim;
+	uint64_t char_initial;
+	int64_t frame;
+	int64_t touch_epoch;
+	uint32_t fixture_order;
+	uint32_t live_fixtures_sorted;
+	uint64_t name_buf_len;
+	uint64_t item_type_count;
+	uint64_t fixture_type_count;
+	uint64_t recipe_count;
+	uint64_t char_count;
+	uint64_t fixture_count;
+	uint64_t fixture_used;
+	uint64_t fixture_free_count;
+	uint64_t obstacle_count;
+	uint64_t nav_node_count;
+	uint64_t nav_edge_count;
+	uint64_t chunk_dim;
+	uint64_t path_used;
+	uint64_t path_live;
+	uint64_t path_live_peak;
+	uint64_t item_timer_count;
+	uint64_t decide_timer_count;
+	uint64_t nav_timer_count;
+	uint32_t path_free_head[PATH_CLASS_COUNT];
+};
+
+const char SNAP_MAGIC[8] = "CITYSNAP";
+
+enum SnapSection {
+	SNAP_NAMES = 1,
+	SNAP_ITEM_TYPES,
+	SNAP_FIXTURE_TYPES,
+	SNAP_RECIPES,
+	SNAP_CHAR_X,
+	SNAP_CHAR_Y,
+	SNAP_CHAR_VELX,
+	SNAP_CHAR_VELY,
+	SNAP_CHAR_NAV,
+	SNAP_CHAR_CRAFT,
+	SNAP_CHAR_RNG,
+	SNAP_CHAR_WATCH_EPOCH,
+	SNAP_FIXTURES,
+	SNAP_LIVE_FIXTURES,
+	SNAP_FIXTURE_FREE,
+	SNAP_OBSTACLES,
+	SNAP_NAV_NODES,
+	SNAP_NAV_EDGE_START,
+	SNAP_NAV_EDGE_TO,
+	SNAP_NAV_EDGE_DIST,
+	SNAP_ROUTE_MISSED,
+	SNAP_PATH_NODES,
+	SNAP_ITEM_TIMERS,
+	SNAP_DECIDE_TIMERS,
+	SNAP_NAV_TIMERS,
+	// each list group is three sections: the lists, then all of their refs,
+	// then all of their watches
+	SNAP_CHUNKS,
+	SNAP_CHUNK_REFS,
+	SNAP_CHUNK_WATCHES,
+	SNAP_TYPE_LISTS,
+	SNAP_TYPE_LIST_REFS,
+	SNAP_TYPE_LIST_WATCHES,
+};
+
+struct SnapSectionHeader {
+	uint32_t id;
+	uint32_t pad;
+	uint64_t size;
+};
+
+struct SnapItem {
+	int32_t type;
+	int32_t change_frame;
+};
+
+struct SnapItemType {
+	uint32_t name; // offset into name_buf
+	int32_t turns_into;
+	int32_t live_frames;
+	uint8_t color[3];
+	uint8_t color_initialized;
+};
+
+struct SnapFixtureType {
+	uint32_t name;
+	uint32_t passable;
+	int64_t width;
+	int64_t height;
+};
+
+struct SnapRecipe {
+	uint32_t name;
+	int32_t duration;
+	uint32_t input_count;
+	uint32_t output_count;
+	int32_t inputs[RECIPE_INPUT_CAP];
+	int32_t outputs[RECIPE_INPUT_CAP];
+};
+
+struct SnapCraft {
+	int64_t craft_x, craft_y;
+	int64_t inputs[RECIPE_INPUT_CAP];
+	int32_t goal;
+	int32_t craft_t;
+	uint32_t input_count;
+	uint32_t pad;
+	struct SnapItem held_item;
+};
+
+struct SnapFixture {
+	int64_t x, y;
+	int32_t type;
+	int32_t change_frame;
+	int32_t storage_count;
+	int32_t touched;
+	struct SnapItem storage[STORAGE_CAP];
+	uint32_t type_slot[STORAGE_CAP];
+};
+
+// a chunk or item type list, whose refs and watches follow in sections of
+// their own
+struct SnapList {
+	uint32_t count;
+	uint32_t watch_count;
+	int32_t touched;
+	uint32_t pad;
+};
+
+// what is saved of a chunk or type list, so both can go through the same
+// code
+struct SnapListView {
+	ref *refs;
+	uint32_t count;
+	int touched;
+	struct Watchers *watchers;
+};
+
+// --- saving ---
+
+bool snap_write(FILE *f, uint32_t id, const void *p, size_t size) {
+	struct SnapSectionHeader h = {id, 0, size};
+	const uint8_t zeroes[8] = {0};
+	return fwrite(&h, sizeof(h), 1, f) == 1
+		&& fwrite(p, 1, size, f) == size
+		&& fwrite(zeroes, 1, -size & 7, f) == (-size & 7);
+}
+
+int32_t snap_index(const void *p, const void *table, size_t size) {
+	return p == NULL ? SNAP_NONE : (int32_t)(((const char*)p - (const char*)table) / size);
+}
+
+struct SnapItem snap_item(struct Item it) {
+	return (struct SnapItem){snap_index(it.type, item_types, sizeof(struct ItemType)), it.change_frame};
+}
+
+uint32_t snap_name(const char *name) {
+	return name == NULL ? ~(uint32_t)0 : name - name_buf;
+}
+
+bool snap_write_lists(FILE *f, uint32_t id, struct SnapListView *views, size_t n) {
+	struct SnapList *lists = calloc(max(n, 1), sizeof(struct SnapList));
+	size_t ref_total = 0;
+	size_t watch_total = 0;
+	range (k, n) {
+		lists[k].count = views[k].count;
+		lists[k].watch_count = views[k].watchers->count;
+		lists[k].touched = views[k].touched;
+		ref_total += views[k].count;
+		watch_total += views[k].watchers->count;
+	}
+	bool ok = snap_write(f, id, lists, n * sizeof(struct SnapList));
+	free(lists);
+	// the refs and watches are written list by list, one section each
+	struct SnapSectionHeader h = {id + 1, 0, ref_total * sizeof(ref)};
+	ok = ok && fwrite(&h, sizeof(h), 1, f) == 1;
+	range (k, n) {
+		ok = ok && fwrite(views[k].refs, sizeof(ref), views[k].count, f) == views[k].count;
+	}
+	ok = ok && fwrite("\0\0\0\0", 1, ref_total % 2 * 4, f) == ref_total % 2 * 4;
+	h = (struct SnapSectionHeader){id + 2, 0, watch_total * sizeof(struct Watch)};
+	ok = ok && fwrite(&h, sizeof(h), 1, f) == 1;
+	range (k, n) {
+		struct Watchers *ws = views[k].watchers;
+		ok = ok && fwrite(ws->list, sizeof(struct Watch), ws->count, f) == ws->count;
+	}
+	return ok;
+}
+
+bool snap_write_tables(FILE *f) {
+	bool ok = snap_write(f, SNAP_NAMES, name_buf, name_buf_len);
+
+	struct SnapItemType *its = calloc(max(item_type_count, 1), sizeof(struct SnapItemType));
+	range (i, item_type_count) {
+		struct ItemType *t = &item_types[i];
+		its[i].name = snap_name(t->name);
+		its[i].turns_into = snap_index(t->turns_into, item_types, sizeof(struct ItemType));
+		its[i].live_frames = t->live_frames;
+		memcpy(its[i].color, t->color, 3);
+		its[i].color_initialized = t->color_initialized;
+	}
+	ok = ok && snap_write(f, SNAP_ITEM_TYPES, its, item_type_count * sizeof(struct SnapItemType));
+	free(its);
+
+	struct SnapFixtureType *fts = calloc(max(fixture_type_count, 1), sizeof(struct SnapFixtureType));
+	range (i, fixture_type_count) {
+		struct FixtureType *t = &fixture_types[i];
+		fts[i].name = snap_name(t->name);
+		fts[i].passable = t->passable;
+		fts[i].width = t->width;
+		fts[i].height = t->height;
+	}
+	ok = ok && snap_write(f, SNAP_FIXTURE_TYPES, fts, fixture_type_count * sizeof(struct SnapFixtureType));
+	free(fts);
+
+	struct SnapRecipe *rs = calloc(max(recipe_count, 1), sizeof(struct SnapRecipe));
+	range (i, recipe_count) {
+		struct Recipe *r = &recipes[i];
+		rs[i].name = snap_name(r->name);
+		rs[i].duration = r->duration;
+		rs[i].input_count = r->input_count;
+		rs[i].output_count = r->output_count;
+		range (k, RECIPE_INPUT_CAP) {
+			rs[i].inputs[k] = k < r->input_count
+				? snap_index(r->inputs[k], item_types, sizeof(struct ItemType)) : SNAP_NONE;
+			rs[i].outputs[k] = k < r->output_count
+				? snap_index(r->outputs[k], item_types, sizeof(struct ItemType)) : SNAP_NONE;
+		}
+	}
+	ok = ok && snap_write(f, SNAP_RECIPES, rs, recipe_count * sizeof(struct SnapRecipe));
+	free(rs);
+	return ok;
+}
+
+bool snap_write_world(FILE *f) {
+	bool ok = snap_write(f, SNAP_CHAR_X, chars.x, char_count * sizeof(num))
+		&& snap_write(f, SNAP_CHAR_Y, chars.y, char_count * sizeof(num))
+		&& snap_write(f, SNAP_CHAR_VELX, chars.velx, char_count * sizeof(num))
+		&& snap_write(f, SNAP_CHAR_VELY, chars.vely, char_count * sizeof(num))
+		&& snap_write(f, SNAP_CHAR_NAV, chars.nav, char_count * sizeof(struct CharNav));
+
+	struct SnapCraft *cs = calloc(max(char_count, 1), sizeof(struct SnapCraft));
+	range (i, char_count) {
+		struct CharCraft *c = &chars.craft[i];
+		cs[i].goal = snap_index(c->goal, recipes, sizeof(struct Recipe));
+		cs[i].craft_x = c->craft_x;
+		cs[i].craft_y = c->craft_y;
+		cs[i].craft_t = c->craft_t;
+		cs[i].input_count = c->input_count;
+		range (k, c->input_count) {
+			cs[i].inputs[k] = c->inputs[k];
+		}
+		cs[i].held_item = snap_item(c->held_item);
+	}
+	ok = ok && snap_write(f, SNAP_CHAR_CRAFT, cs, char_count * sizeof(struct SnapCraft));
+	free(cs);
+	ok = ok && snap_write(f, SNAP_CHAR_RNG, chars.rng, char_count * sizeof(struct Rng))
+		&& snap_write(f, SNAP_CHAR_WATCH_EPOCH, char_watch_epoch, char_count * sizeof(uint32_t));
+
+	struct SnapFixture *fs = calloc(max(fixture_used, 1), sizeof(struct SnapFixture));
+	range (i, fixture_used) {
+		Fixture fx = &fixtures[i];
+		fs[i].x = fx->x;
+		fs[i].y = fx->y;
+		fs[i].type = snap_index(fx->type, fixture_types, sizeof(struct FixtureType));
+		fs[i].change_frame = fx->change_frame;
+		fs[i].storage_count = fx->storage_count;
+		fs[i].touched = fx->touched;
+		range (j, fx->type ? fx->storage_count : 0) {
+			fs[i].storage[j] = snap_item(fx->storage[j]);
+			fs[i].type_slot[j] = fx->type_slot[j];
+		}
+	}
+	ok = ok && snap_write(f, SNAP_FIXTURES, fs, fixture_used * sizeof(struct SnapFixture));
+	free(fs);
+	uint32_t *live = malloc(max(fixture_count, 1) * sizeof(uint32_t));
+	range (k, fixture_count) {
+		live[k] = live_fixtures[k] - fixtures;
+	}
+	ok = ok && snap_write(f, SNAP_LIVE_FIXTURES, live, fixture_count * sizeof(uint32_t))
+		&& snap_write(f, SNAP_FIXTURE_FREE, fixture_free, fixture_free_count * sizeof(uint32_t));
+	free(live);
+
+	ok = ok && snap_write(f, SNAP_OBSTACLES, obstacles, obstacle_count * sizeof(struct Obstacle))
+		&& snap_write(f, SNAP_NAV_NODES, nav_nodes, nav_node_count * sizeof(struct NavNode))
+		&& snap_write(f, SNAP_NAV_EDGE_START, nav_edge_start, (nav_node_count + 1) * sizeof(uint32_t))
+		&& snap_write(f, SNAP_NAV_EDGE_TO, nav_edge_to, nav_edge_count * sizeof(uint32_t))
+		&& snap_write(f, SNAP_NAV_EDGE_DIST, nav_edge_dist, nav_edge_count * sizeof(num))
+		&& snap_write(f, SNAP_ROUTE_MISSED, route_cache.missed, nav_node_count)
+		&& snap_write(f, SNAP_PATH_NODES, path_arena.nodes, path_arena.used * sizeof(uint32_t))
+		&& snap_write(f, SNAP_ITEM_TIMERS, item_timers.heap, item_timers.count * sizeof(struct Timer))
+		&& snap_write(f, SNAP_DECIDE_TIMERS, decide_timers.heap, decide_timers.count * sizeof(struct Timer))
+		&& snap_write(f, SNAP_NAV_TIMERS, nav_timers.heap, nav_timers.count * sizeof(struct Timer));
+
+	size_t chunk_count = chunk_dim * chunk_dim;
+	struct SnapListView *views = malloc(max(max(chunk_count, chunk_type_count), 1) * sizeof(struct SnapListView));
+	range (i, chunk_count) {
+		views[i] = (struct SnapListView){
+			chunks[i].refs, chunks[i].total_num, chunks[i].touched, &chunks[i].watchers
+		};
+	}
+	ok = ok && snap_write_lists(f, SNAP_CHUNKS, views, chunk_count);
+	range (i, chunk_type_count) {
+		views[i] = (struct SnapListView){
+			chunk_types[i].refs, chunk_types[i].count, 0, &chunk_types[i].watchers
+		};
+	}
+	ok = ok && snap_write_lists(f, SNAP_TYPE_LISTS, views, chunk_type_count);
+	free(views);
+	return ok;
+}
+
+// Writes the world as it is between frames to path, by way of a temporary
+// file, so that a snapshot that fails halfway never replaces a good one.
+// Returns whether it worked.
+bool snapshot_save(const char *path) {
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *f = fopen(tmp, "wb");
+	if (f == NULL) {
+		printf("ERROR: Could not open %s to save a snapshot\n", tmp);
+		return false;
+	}
+	struct SnapHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+	h.version = SNAPSHOT_VERSION;
+	h.byte_order = 0x01020304;
+	h.world_seed = world_seed;
+	h.world_idim = world_idim;
+	h.char_initial = char_initial;
+	h.frame = frame;
+	h.touch_epoch = touch_epoch;
+	h.fixture_order = fixture_order;
+	h.live_fixtures_sorted = live_fixtures_sorted;
+	h.name_buf_len = name_buf_len;
+	h.item_type_count = item_type_count;
+	h.fixture_type_count = fixture_type_count;
+	h.recipe_count = recipe_count;
+	h.char_count = char_count;
+	h.fixture_count = fixture_count;
+	h.fixture_used = fixture_used;
+	h.fixture_free_count = fixture_free_count;
+	h.obstacle_count = obstacle_count;
+	h.nav_node_count = nav_node_count;
+	h.nav_edge_count = nav_edge_count;
+	h.chunk_dim = chunk_dim;
+	h.path_used = path_arena.used;
+	h.path_live = path_arena.live;
+	h.path_live_peak = path_arena.live_peak;
+	h.item_timer_count = item_timers.count;
+	h.decide_timer_count = decide_timers.count;
+	h.nav_timer_count = nav_timers.count;
+	memcpy(h.path_free_head, path_arena.free_head, sizeof(h.path_free_head));
+
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && snap_write_tables(f) && snap_write_world(f);
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp, path) != 0) {
+		printf("ERROR: Could not write snapshot %s\n", path);
+		remove(tmp);
+		return false;
+	}
+	return true;
+}
+
+// --- loading ---
+
+struct SnapReader {
+	const uint8_t *data;
+	size_t size;
+	size_t at;
+	const char *path;
+};
+
+void snap_corrupt(struct SnapReader *r, const char *what) {
+	printf("ERROR: Snapshot %s is corrupt: %s\n", r->path, what);
+	exit(1);
+}
+
+// the next section, which has to be id and size bytes long
+const void *snap_read(struct SnapReader *r, uint32_t id, size_t size) {
+	struct SnapSectionHeader h;
+	if (r->size - r->at < sizeof(h)) {
+		snap_corrupt(r, "it ends early");
+	}
+	memcpy(&h, r->data + r->at, sizeof(h));
+	if (h.id != id || h.size != size || r->size - r->at - sizeof(h) < size) {
+		snap_corrupt(r, "a section is out of place or the wrong size");
+	}
+	const void *p = r->data + r->at + sizeof(h);
+	r->at += sizeof(h) + ((size + 7) & ~(size_t)7);
+	return p;
+}
+
+void *snap_index_ptr(struct SnapReader *r, int32_t index, void *table, size_t count, size_t size) {
+	if (index == SNAP_NONE) {
+		return NULL;
+	}
+	if (index < 0 || (size_t)index >= count) {
+		snap_corrupt(r, "an index is out of range");
+	}
+	return (char*)table + index * size;
+}
+
+struct Item snap_load_item(struct SnapReader *r, struct SnapItem it) {
+	return (struct Item){
+		it.change_frame,
+		snap_index_ptr(r, it.type, item_types, item_type_count, sizeof(struct ItemType)),
+	};
+}
+
+char *snap_load_name(struct SnapReader *r, uint32_t name) {
+	if (name == ~(uint32_t)0) {
+		return NULL;
+	}
+	if (name >= name_buf_len) {
+		snap_corrupt(r, "a name is out of range");
+	}
+	return &name_buf[name];
+}
+
+void snap_load_tables(struct SnapReader *r, struct SnapHeader *h) {
+	if (h->name_buf_len > NAME_BUF_CAP || h->item_type_count > ITEM_TYPE_CAP
+		|| h->fixture_type_count > FIXTURE_TYPE_CAP || h->recipe_count > RECIPE_CAP
+	) {
+		snap_corrupt(r, "its tables are too big");
+	}
+	name_buf_len = h->name_buf_len;
+	item_type_count = h->item_type_count;
+	fixture_type_count = h->fixture_type_count;
+	recipe_count = h->recipe_count;
+	memcpy(name_buf, snap_read(r, SNAP_NAMES, name_buf_len), name_buf_len);
+
+	const struct SnapItemType *its = snap_read(r, SNAP_ITEM_TYPES, item_type_count * sizeof(struct SnapItemType));
+	range (i, item_type_count) {
+		struct ItemType *t = &item_types[i];
+		t->name = snap_load_name(r, its[i].name);
+		t->turns_into = snap_index_ptr(r, its[i].turns_into, item_types, item_type_count, sizeof(struct ItemType));
+		t->live_frames = its[i].live_frames;
+		memcpy(t->color, its[i].color, 3);
+		t->color_initialized = its[i].color_initialized;
+	}
+
+	const struct SnapFixtureType *fts = snap_read(r, SNAP_FIXTURE_TYPES, fixture_type_count * sizeof(struct SnapFixtureType));
+	range (i, fixture_type_count) {
+		struct FixtureType *t = &fixture_types[i];
+		t->name = snap_load_name(r, fts[i].name);
+		t->passable = fts[i].passable;
+		t->width = fts[i].width;
+		t->height = fts[i].height;
+	}
+
+	const struct SnapRecipe *rs = snap_read(r, SNAP_RECIPES, recipe_count * sizeof(struct SnapRecipe));
+	range (i, recipe_count) {
+		struct Recipe *rc = &recipes[i];
+		if (rs[i].input_count > RECIPE_INPUT_CAP || rs[i].output_count > RECIPE_INPUT_CAP) {
+			snap_corrupt(r, "a recipe is too big");
+		}
+		rc->name = snap_load_name(r, rs[i].name);
+		rc->duration = rs[i].duration;
+		rc->input_count = rs[i].input_count;
+		rc->output_count = rs[i].output_count;
+		range (k, rc->input_count) {
+			rc->inputs[k] = snap_index_ptr(r, rs[i].inputs[k], item_types, item_type_count, sizeof(struct ItemType));
+		}
+		range (k, rc->output_count) {
+			rc->outputs[k] = snap_index_ptr(r, rs[i].outputs[k], item_types, item_type_count, sizeof(struct ItemType));
+		}
+	}
+}
+
+// a ref to a character or fixture slot that exists
+bool snap_ref_ok(ref x) {
+	size_t limit = (x & REF_SORT) == REF_CHAR ? char_count : fixture_used;
+	return (x & REF_IND) < limit;
+}
+
+// on the map, so that its chunk is one of chunks
+bool snap_pos_ok(num x, num y) {
+	return -DIM <= x && x <= DIM && -DIM <= y && y <= DIM;
+}
+
+// owners are refs if refs is set, character indices otherwise
+void snap_load_timers(struct SnapReader *r, uint32_t id, struct Timers *t, size_t count, bool refs) {
+	const struct Timer *heap = snap_read(r, id, count * sizeof(struct Timer));
+	range (k, count) {
+		if (refs ? !snap_ref_ok(heap[k].owner) : heap[k].owner >= char_count) {
+			snap_corrupt(r, "a timer is for something that doesn't exist");
+		}
+	}
+	// grown even for nothing, since memcpy can't be given NULL
+	if (t->cap < count || t->heap == NULL) {
+		t->cap = max(count, 1);
+		t->heap = world_array(t->heap, t->cap, sizeof(struct Timer));
+	}
+	memcpy(t->heap, heap, count * sizeof(struct Timer));
+	t->count = count;
+}
+
+// fills in views[k].count, touched and watchers of each list from the
+// snapshot, and returns where all of their refs start, for the caller to
+// copy out
+const ref *snap_load_lists(struct SnapReader *r, uint32_t id, struct SnapListView *views, size_t n) {
+	const struct SnapList *lists = snap_read(r, id, n * sizeof(struct SnapList));
+	size_t ref_total = 0;
+	size_t watch_total = 0;
+	range (k, n) {
+		ref_total += lists[k].count;
+		watch_total += lists[k].watch_count;
+	}
+	const ref *refs = snap_read(r, id + 1, ref_total * sizeof(ref));
+	const struct Watch *watches = snap_read(r, id + 2, watch_total * sizeof(struct Watch));
+	range (k, n) {
+		struct Watchers *ws = views[k].watchers;
+		views[k].count = lists[k].count;
+		views[k].touched = lists[k].touched;
+		if (ws->cap < lists[k].watch_count || ws->list == NULL) {
+			ws->cap = max(lists[k].watch_count, 4);
+			ws->list = world_array(ws->list, ws->cap, sizeof(struct Watch));
+		}
+		range (w, lists[k].watch_count) {
+			if (watches[w].who >= char_count) {
+				snap_corrupt(r, "a watch is for a character that doesn't exist");
+			}
+		}
+		memcpy(ws->list, watches, lists[k].watch_count * sizeof(struct Watch));
+		ws->count = lists[k].watch_count;
+		watches += lists[k].watch_count;
+	}
+	return refs;
+}
+
+void snap_load_world(struct SnapReader *r, struct SnapHeader *h) {
+	char_count = h->char_count;
+	if (char_count > char_cap || h->fixture_used > fixture_cap
+		|| h->fixture_count > h->fixture_used || h->fixture_free_count > h->fixture_used
+		|| h->obstacle_count > OBSTACLE_CAP || h->nav_node_count > NAV_NODE_CAP
+		|| h->chunk_dim != chunk_dim
+	) {
+		snap_corrupt(r, "it doesn't fit the world it says it is");
+	}
+	memcpy(chars.x, snap_read(r, SNAP_CHAR_X, char_count * sizeof(num)), char_count * sizeof(num));
+	memcpy(chars.y, snap_read(r, SNAP_CHAR_Y, char_count * sizeof(num)), char_count * sizeof(num));
+	memcpy(chars.velx, snap_read(r, SNAP_CHAR_VELX, char_count * sizeof(num)), char_count * sizeof(num));
+	memcpy(chars.vely, snap_read(r, SNAP_CHAR_VELY, char_count * sizeof(num)), char_count * sizeof(num));
+	memcpy(chars.nav, snap_read(r, SNAP_CHAR_NAV, char_count * sizeof(struct CharNav)),
+		char_count * sizeof(struct CharNav));
+	range (i, char_count) {
+		if (!snap_pos_ok(chars.x[i], chars.y[i])
+			|| !snap_pos_ok(chars.nav[i].endx, chars.nav[i].endy)
+		) {
+			snap_corrupt(r, "a character is off the map");
+		}
+	}
+	const struct SnapCraft *cs = snap_read(r, SNAP_CHAR_CRAFT, char_count * sizeof(struct SnapCraft));
+	range (i, char_count) {
+		struct CharCraft *c = &chars.craft[i];
+		if (cs[i].input_count > RECIPE_INPUT_CAP) {
+			snap_corrupt(r, "a character holds too many inputs");
+		}
+		c->goal = snap_index_ptr(r, cs[i].goal, recipes, recipe_count, sizeof(struct Recipe));
+		if (!snap_pos_ok(cs[i].craft_x, cs[i].craft_y)) {
+			snap_corrupt(r, "a character is crafting off the map");
+		}
+		c->craft_x = cs[i].craft_x;
+		c->craft_y = cs[i].craft_y;
+		c->craft_t = cs[i].craft_t;
+		c->input_count = cs[i].input_count;
+		range (k, c->input_count) {
+			if (cs[i].inputs[k] < 0 || (uint64_t)cs[i].inputs[k] >= h->fixture_used) {
+				snap_corrupt(r, "a character's input is a fixture that doesn't exist");
+			}
+			c->inputs[k] = cs[i].inputs[k];
+		}
+		c->held_item = snap_load_item(r, cs[i].held_item);
+	}
+	memcpy(chars.rng, snap_read(r, SNAP_CHAR_RNG, char_count * sizeof(struct Rng)),
+		char_count * sizeof(struct Rng));
+	memcpy(char_watch_epoch, snap_read(r, SNAP_CHAR_WATCH_EPOCH, char_count * sizeof(uint32_t)),
+		char_count * sizeof(uint32_t));
+
+	fixture_used = h->fixture_used;
+	fixture_count = h->fixture_count;
+	fixture_free_count = h->fixture_free_count;
+	const struct SnapFixture *fs = snap_read(r, SNAP_FIXTURES, fixture_used * sizeof(struct SnapFixture));
+	range (i, fixture_used) {
+		Fixture fx = &fixtures[i];
+		if (fs[i].storage_count < 0 || fs[i].storage_count > STORAGE_CAP) {
+			snap_corrupt(r, "a fixture holds too many items");
+		}
+		fx->x = fs[i].x;
+		fx->y = fs[i].y;
+		fx->type = snap_index_ptr(r, fs[i].type, fixture_types, fixture_type_count, sizeof(struct FixtureType));
+		if (fx->type != NULL && !snap_pos_ok(fx->x, fx->y)) {
+			snap_corrupt(r, "a fixture is off the map");
+		}
+		fx->change_frame = fs[i].change_frame;
+		fx->storage_count = fs[i].storage_count;
+		fx->touched = fs[i].touched;
+		range (j, fx->type ? fx->storage_count : 0) {
+			fx->storage[j] = snap_load_item(r, fs[i].storage[j]);
+			fx->type_slot[j] = fs[i].type_slot[j];
+		}
+	}
+	const uint32_t *live = snap_read(r, SNAP_LIVE_FIXTURES, fixture_count * sizeof(uint32_t));
+	range (k, fixture_count) {
+		if (live[k] >= fixture_used || fixtures[live[k]].type == NULL) {
+			snap_corrupt(r, "a live fixture isn't");
+		}
+		live_fixtures[k] = &fixtures[live[k]];
+		fixture_live_slot[live[k]] = k;
+	}
+	memcpy(fixture_free, snap_read(r, SNAP_FIXTURE_FREE, fixture_free_count * sizeof(uint32_t)),
+		fixture_free_count * sizeof(uint32_t));
+	range (k, fixture_free_count) {
+		if (fixture_free[k] >= fixture_used || fixtures[fixture_free[k]].type != NULL) {
+			snap_corrupt(r, "a free fixture slot isn't");
+		}
+	}
+	live_fixtures_sorted = h->live_fixtures_sorted;
+
+	obstacle_count = h->obstacle_count;
+	memcpy(obstacles, snap_read(r, SNAP_OBSTACLES, obstacle_count * sizeof(struct Obstacle)),
+		obstacle_count * sizeof(struct Obstacle));
+	range (o, obstacle_count) {
+		struct Obstacle *ob = &obstacles[o];
+		// they can hang off the edge, but not by more than their size
+		if (!snap_pos_ok(ob->l / 2, ob->b / 2) || !snap_pos_ok(ob->r / 2, ob->t / 2)
+			|| ob->l >= ob->r || ob->b >= ob->t
+		) {
+			snap_corrupt(r, "an obstacle is too far off the map");
+		}
+	}
+	build_obstacle_grid();
+	nav_node_count = h->nav_node_count;
+	nav_edge_count = h->nav_edge_count;
+	memcpy(nav_nodes, snap_read(r, SNAP_NAV_NODES, nav_node_count * sizeof(struct NavNode)),
+		nav_node_count * sizeof(struct NavNode));
+	range (i, nav_node_count) {
+		if (!snap_pos_ok(nav_nodes[i].x, nav_nodes[i].y)) {
+			snap_corrupt(r, "a nav node is off the map");
+		}
+	}
+	memcpy(nav_edge_start, snap_read(r, SNAP_NAV_EDGE_START, (nav_node_count + 1) * sizeof(uint32_t)),
+		(nav_node_count + 1) * sizeof(uint32_t));
+	bool graph_ok = nav_edge_start[0] == 0 && nav_edge_start[nav_node_count] == nav_edge_count;
+	range (i, nav_node_count) {
+		graph_ok = graph_ok && nav_edge_start[i] <= nav_edge_start[i + 1];
+	}
+	if (!graph_ok) {
+		snap_corrupt(r, "the nav graph doesn't add up");
+	}
+	nav_edge_to = world_array(nav_edge_to, nav_edge_count, sizeof(uint32_t));
+	nav_edge_dist = world_array(nav_edge_dist, nav_edge_count, sizeof(num));
+	memcpy(nav_edge_to, snap_read(r, SNAP_NAV_EDGE_TO, nav_edge_count * sizeof(uint32_t)),
+		nav_edge_count * sizeof(uint32_t));
+	memcpy(nav_edge_dist, snap_read(r, SNAP_NAV_EDGE_DIST, nav_edge_count * sizeof(num)),
+		nav_edge_count * sizeof(num));
+	range (e, nav_edge_count) {
+		if (nav_edge_to[e] >= nav_node_count) {
+			snap_corrupt(r, "a nav edge goes to a node that doesn't exist");
+		}
+		// the route cache adds these up, so they have to be as long as
+		// the map allows and no shorter than nothing
+		if (nav_edge_dist[e] < 0 || nav_edge_dist[e] > 4 * DIM) {
+			snap_corrupt(r, "a nav edge is the wrong length");
+		}
+	}
+	route_cache_clear();
+	memcpy(route_cache.missed, snap_read(r, SNAP_ROUTE_MISSED, nav_node_count),
+		nav_node_count);
+	range (i, nav_node_count) {
+		if (route_cache.missed[i] > ROUTE_MISSED_BEFORE) {
+			snap_corrupt(r, "a route cache miss mark is out of range");
+		}
+	}
+
+	path_arena_clear();
+	path_arena.used = h->path_used;
+	path_arena.live = h->path_live;
+	path_arena.live_peak = h->path_live_peak;
+	memcpy(path_arena.free_head, h->path_free_head, sizeof(path_arena.free_head));
+	if (path_arena.cap < path_arena.used || path_arena.nodes == NULL) {
+		path_arena.cap = max(path_arena.used, 1024);
+		path_arena.nodes = world_array(path_arena.nodes, path_arena.cap, sizeof(uint32_t));
+	}
+	memcpy(path_arena.nodes, snap_read(r, SNAP_PATH_NODES, path_arena.used * sizeof(uint32_t)),
+		path_arena.used * sizeof(uint32_t));
+	// every free slice has to fit in the arena, and the lists can't loop
+	range (c, PATH_CLASS_COUNT) {
+		size_t size = (size_t)1 << c;
+		size_t steps = 0;
+		for (uint32_t at = path_arena.free_head[c]; at != PATH_NONE; at = path_arena.nodes[at]) {
+			if (at + size > path_arena.used || ++steps > path_arena.used / size) {
+				snap_corrupt(r, "a free path slice isn't in the arena");
+			}
+		}
+	}
+	range (i, char_count) {
+		struct CharNav *n = &chars.nav[i];
+		if (n->path_count == 0) {
+			continue;
+		}
+		if (n->path_class >= PATH_CLASS_COUNT || n->path_count > (size_t)1 << n->path_class
+			|| n->path_start + ((size_t)1 << n->path_class) > path_arena.used
+		) {
+			snap_corrupt(r, "a character's path isn't in the arena");
+		}
+		range (k, n->path_count) {
+			if (path_arena.nodes[n->path_start + k] >= nav_node_count) {
+				snap_corrupt(r, "a character's path goes through a node that doesn't exist");
+			}
+		}
+	}
+
+	snap_load_timers(r, SNAP_ITEM_TIMERS, &item_timers, h->item_timer_count, true);
+	snap_load_timers(r, SNAP_DECIDE_TIMERS, &decide_timers, h->decide_timer_count, false);
+	snap_load_timers(r, SNAP_NAV_TIMERS, &nav_timers, h->nav_timer_count, false);
+
+	// the slot back-indices come back from where each ref sits
+	size_t chunk_count = chunk_dim * chunk_dim;
+	struct SnapListView *views = malloc(max(max(chunk_count, chunk_type_count), 1) * sizeof(struct SnapListView));
+	range (i, chunk_count) {
+		views[i].watchers = &chunks[i].watchers;
+	}
+	const ref *refs = snap_load_lists(r, SNAP_CHUNKS, views, chunk_count);
+	range (i, chunk_count) {
+		struct Chunk *chunk = &chunks[i];
+		if (chunk->cap < views[i].count) {
+			chunk->cap = views[i].count;
+			chunk->refs = world_array(chunk->refs, chunk->cap, sizeof(ref));
+		}
+		chunk->total_num = views[i].count;
+		chunk->touched = views[i].touched;
+		range (k, views[i].count) {
+			ref x = refs[k];
+			if (!snap_ref_ok(x)) {
+				snap_corrupt(r, "a chunk holds something that doesn't exist");
+			}
+			chunk->refs[k] = x;
+			*chunk_slot(x) = k;
+		}
+		refs += views[i].count;
+	}
+	range (i, chunk_type_count) {
+		views[i].watchers = &chunk_types[i].watchers;
+	}
+	refs = snap_load_lists(r, SNAP_TYPE_LISTS, views, chunk_type_count);
+	range (i, chunk_type_count) {
+		struct TypeList *list = &chunk_types[i];
+		if (list->cap < views[i].count || list->refs == NULL) {
+			list->cap = max(views[i].count, 4);
+			list->refs = world_array(list->refs, list->cap, sizeof(ref));
+		}
+		list->count = views[i].count;
+		range (k, views[i].count) {
+			if ((refs[k] & REF_SORT) != REF_FIXTURE || !snap_ref_ok(refs[k])) {
+				snap_corrupt(r, "an item type list holds a fixture that doesn't exist");
+			}
+		}
+		memcpy(list->refs, refs, views[i].count * sizeof(ref));
+		refs += views[i].count;
+	}
+	free(views);
+	// each stored item has to be where its fixture says in its type list
+	range (i, fixture_used) {
+		Fixture fx = &fixtures[i];
+		range (j, fx->type ? fx->storage_count : 0) {
+			if (fx->storage[j].type == NULL) {
+				continue;
+			}
+			struct TypeList *list = fixture_type_list(i, fx->storage[j].type);
+			if (fx->type_slot[j] >= list->count || list->refs[fx->type_slot[j]] != (i | REF_FIXTURE)) {
+				snap_corrupt(r, "a stored item isn't where its type list says");
+			}
+		}
+	}
+	decide_cursor = LONG_MAX;
+}
+
+// Replaces parse_data() and init(), picking up the world saved in path
+// exactly where it left off.
+void snapshot_load(const char *path) {
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		printf("ERROR: Could not open snapshot %s\n", path);
+		exit(1);
+	}
+	struct SnapReader r = {NULL, st.st_size, 0, path};
+	if (r.size < sizeof(struct SnapHeader)) {
+		snap_corrupt(&r, "it is too short");
+	}
+	r.data = mmap(NULL, r.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (r.data == MAP_FAILED) {
+		printf("ERROR: Could not map snapshot %s\n", path);
+		exit(1);
+	}
+	struct SnapHeader h;
+	memcpy(&h, r.data, sizeof(h));
+	r.at = sizeof(h);
+	if (memcmp(h.magic, SNAP_MAGIC, sizeof(h.magic)) != 0) {
+		snap_corrupt(&r, "it isn't a snapshot");
+	}
+	if (h.version != SNAPSHOT_VERSION || h.byte_order != 0x01020304) {
+		printf("ERROR: Snapshot %s is version %u, this build reads version %d on machines like the one it was built for\n",
+			path, h.version, SNAPSHOT_VERSION);
+		exit(1);
+	}
+
+	snap_load_tables(&r, &h);
+
+	if (pool.thread_count != sim_threads) {
+		pool_init(sim_threads);
+	}
+	world_seed = h.world_seed;
+	world_idim = h.world_idim;
+	char_initial = h.char_initial;
+	fixture_order = h.fixture_order == FIXTURE_ORDER_SORTED ? FIXTURE_ORDER_SORTED : FIXTURE_ORDER_DENSE;
+	frame = h.frame;
+	touch_epoch = h.touch_epoch;
+	size_world();
+	snap_load_world(&r, &h);
+	if (r.at != r.size) {
+		snap_corrupt(&r, "there is more after the last section");
+	}
+	munmap((void*)r.data, r.size);
+	printf("Loaded %lu characters, %lu fixtures at frame %d from %s\n",
+		char_count, fixture_count, frame, path);
+}
+
+// --- checkpoints ---
+
+// the child writing the last checkpoint, if it hasn't been waited for
+pid_t checkpoint_pid = 0;
+
+// Reaps the last checkpoint's child, waiting for it if block is set.
+// Returns false if it is still going.
+bool snapshot_checkpoint_reap(bool block) {
+	if (checkpoint_pid <= 0) {
+		return true;
+	}
+	int status;
+	pid_t done = waitpid(checkpoint_pid, &status, block ? 0 : WNOHANG);
+	if (done == 0) {
+		return false;
+	}
+	if (done != checkpoint_pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		printf("WARNING: a checkpoint failed to save\n");
+	}
+	checkpoint_pid = 0;
+	return true;
+}
+
+// Saves the world to path in the background. If the last checkpoint is
+// still being written this one is skipped rather than waiting for it.
+void snapshot_checkpoint(const char *path) {
+	if (!snapshot_checkpoint_reap(false)) {
+		printf("WARNING: checkpoint at frame %d skipped, the last one isn't done\n", frame);
+		return;
+	}
+	// anything still buffered would otherwise be printed twice
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		printf("WARNING: could not fork for a checkpoint, saving it in the foreground\n");
+		snapshot_save(path);
+		return;
+	}
+	if (pid == 0) {
+		bool ok = snapshot_save(path);
+		fflush(stdout);
+		_exit(ok ? 0 : 1);
+	}
+	checkpoint_pid = pid;
+}
+
+// Options for snapshots, shared by every entry point like sim_option.
+char *snapshot_load_path = NULL;
+char *checkpoint_path = NULL;
+long checkpoint_every = 0;
+
+bool snapshot_option(int argc, char **argv, int *i) {
+	if (strcmp(argv[*i], "--load") == 0 && *i + 1 < argc) {
+		*i += 1;
+		snapshot_load_path = argv[*i];
+		return true;
+	}
+	if (strcmp(argv[*i], "--checkpoint") == 0 && *i + 1 < argc) {
+		*i += 1;
+		checkpoint_path = argv[*i];
+		return true;
+	}
+	if (strcmp(argv[*i], "--checkpoint-every") == 0 && *i + 1 < argc) {
+		*i += 1;
+		checkpoint_every = atol(argv[*i]);
+		return true;
+	}
+	return false;
+}
+
+// call after every simulate()
+void snapshot_frame_done() {
+	if (checkpoint_path != NULL && checkpoint_every > 0 && frame % checkpoint_every == 0) {
+		snapshot_checkpoint(checkpoint_path);
+	}
+}
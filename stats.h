@@ -0,0 +1,129 @@
+#pragma once
+
+#include "util.h"
+
+// Instrumentation for simulate(). Build with -DSIM_STATS to collect it,
+// otherwise every STAT_ macro below expands to nothing.
+
+enum SimPhase {
+	PHASE_ITEMS,
+	PHASE_DECISIONS,
+	PHASE_NAVIGATION,
+	PHASE_MOVEMENT,
+	PHASE_COUNT,
+};
+
+struct SimStats {
+	uint64_t frames;
+	uint64_t phase_ns[PHASE_COUNT];
+	uint64_t find_nearest;
+	uint64_t pick_route;
+	uint64_t interval_obstructed;
+	uint64_t create_fixture;
+	uint64_t destroy_fixture;
+	uint64_t chunk_moves;
+	uint64_t decided; // characters the decision phase looked at
+	uint64_t navigated; // and the navigation phase moved along
+};
+
+#ifdef SIM_STATS
+
+#include <pthread.h>
+
+const char *sim_phase_names[PHASE_COUNT] = {
+	"items", "decisions", "navigation", "movement"
+};
+
+// sim_stats_frame is the frame in progress, sim_stats_last the last frame
+// to finish, sim_stats_window everything since the last summary line and
+// sim_stats_run everything since startup
+//
+// the frame in progress is per thread, so that worker threads don't fight
+// over the counters; they fold theirs into sim_stats_threads after each job
+_Thread_local struct SimStats sim_stats_frame;
+struct SimStats sim_stats_threads;
+pthread_mutex_t sim_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+struct SimStats sim_stats_last;
+struct SimStats sim_stats_window;
+struct SimStats sim_stats_run;
+
+void sim_stats_add(struct SimStats *to, struct SimStats *from) {
+	to->frames += from->frames;
+	range (p, PHASE_COUNT) {
+		to->phase_ns[p] += from->phase_ns[p];
+	}
+	to->find_nearest += from->find_nearest;
+	to->pick_route += from->pick_route;
+	to->interval_obstructed += from->interval_obstructed;
+	to->create_fixture += from->create_fixture;
+	to->destroy_fixture += from->destroy_fixture;
+	to->chunk_moves += from->chunk_moves;
+	to->decided += from->decided;
+	to->navigated += from->navigated;
+}
+
+void sim_stats_flush_thread() {
+	pthread_mutex_lock(&sim_stats_lock);
+	sim_stats_add(&sim_stats_threads, &sim_stats_frame);
+	pthread_mutex_unlock(&sim_stats_lock);
+	memset(&sim_stats_frame, 0, sizeof(sim_stats_frame));
+}
+
+void sim_stats_end_frame() {
+	sim_stats_add(&sim_stats_frame, &sim_stats_threads);
+	memset(&sim_stats_threads, 0, sizeof(sim_stats_threads));
+	sim_stats_frame.frames = 1;
+	sim_stats_last = sim_stats_frame;
+	sim_stats_add(&sim_stats_window, &sim_stats_frame);
+	sim_stats_add(&sim_stats_run, &sim_stats_frame);
+	memset(&sim_stats_frame, 0, sizeof(sim_stats_frame));
+}
+
+// averages per frame, all on one line
+void sim_stats_print(const char *label, struct SimStats *s) {
+	if (s->frames == 0) {
+		return;
+	}
+	double n = (double)s->frames;
+	printf("%s (%lu frames):", label, s->frames);
+	range (p, PHASE_COUNT) {
+		printf(" %s %.3f ms,", sim_phase_names[p], (double)s->phase_ns[p] / n / 1e6);
+	}
+	printf(" find_nearest %.1f, pick_route %.1f, interval_obstructed %.1f,"
+		" create_fixture %.1f, destroy_fixture %.1f, chunk moves %.1f,"
+		" decided %.1f, navigated %.1f per frame\n",
+		(double)s->find_nearest / n,
+		(double)s->pick_route / n,
+		(double)s->interval_obstructed / n,
+		(double)s->create_fixture / n,
+		(double)s->destroy_fixture / n,
+		(double)s->chunk_moves / n,
+		(double)s->decided / n,
+		(double)s->navigated / n);
+}
+
+void sim_stats_summary() {
+	sim_stats_print("stats", &sim_stats_window);
+	memset(&sim_stats_window, 0, sizeof(sim_stats_window));
+}
+
+#define STAT_INC(counter) (sim_stats_frame.counter += 1)
+#define STAT_PHASE_BEGIN(phase) uint64_t stat_start_##phase = now_ns()
+#define STAT_PHASE_END(phase) \
+	(sim_stats_frame.phase_ns[phase] += now_ns() - stat_start_##phase)
+#define STAT_FLUSH_THREAD() sim_stats_flush_thread()
+#define STAT_END_FRAME() sim_stats_end_frame()
+#define STAT_SUMMARY() sim_stats_summary()
+#define STAT_PRINT_RUN() sim_stats_print("stats for whole run", &sim_stats_run)
+
+#else
+
+#define STAT_INC(counter)
+#define STAT_PHASE_BEGIN(phase)
+#define STAT_PHASE_END(phase)
+#define STAT_FLUSH_THREAD()
+#define STAT_END_FRAME()
+#define STAT_SUMMARY()
+#define STAT_PRINT_RUN()
+
+#endif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "util.h"
+
+// Things that need looking at on some later frame, so that the frame loop
+// only visits what is due rather than checking everything. Each timer is a
+// frame and an owner, an index or ref the caller gives meaning to, kept in
+// a min heap on frame.
+//
+// Timers are never cancelled. If an owner changes or goes away the old
+// timer stays in the heap and still comes due, so callers have to check
+// that the owner actually has something due, and be fine with an owner
+// coming up twice.
+
+struct Timer {
+	long frame;
+	uint32_t owner;
+};
+
+struct Timers {
+	struct Timer *heap;
+	size_t count;
+	size_t cap;
+	uint32_t *due; // owners popped by timers_pop_due
+	size_t due_cap;
+};
+
+bool timer_before(struct Timer a, struct Timer b) {
+	return a.frame < b.frame || (a.frame == b.frame && a.owner < b.owner);
+}
+
+void timers_clear(struct Timers *t) {
+	t->count = 0;
+}
+
+void timers_add(struct Timers *t, long frame, uint32_t owner) {
+	if (t->count == t->cap) {
+		t->cap = max(2 * t->cap, 1024);
+		t->heap = realloc(t->heap, t->cap * sizeof(struct Timer));
+		if (t->heap == NULL) {
+			printf("ERROR: Out of memory for timers\n");
+			exit(1);
+		}
+	}
+	struct Timer timer = {frame, owner};
+	size_t k = t->count++;
+	while (k > 0 && timer_before(timer, t->heap[(k - 1) / 2])) {
+		t->heap[k] = t->heap[(k - 1) / 2];
+		k = (k - 1) / 2;
+	}
+	t->heap[k] = timer;
+}
+
+struct Timer timers_pop(struct Timers *t) {
+	struct Timer top = t->heap[0];
+	t->count -= 1;
+	struct Timer last = t->heap[t->count];
+	size_t k = 0;
+	while (2 * k + 1 < t->count) {
+		size_t child = 2 * k + 1;
+		if (child + 1 < t->count && timer_before(t->heap[child + 1], t->heap[child])) {
+			child += 1;
+		}
+		if (!timer_before(t->heap[child], last)) {
+			break;
+		}
+		t->heap[k] = t->heap[child];
+		k = child;
+	}
+	t->heap[k] = last;
+	return top;
+}
+
+int cmp_timer_owner(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+// Takes every timer due by frame out of the heap, leaving their owners in
+// t->due in increasing order with repeats removed, and returns how many.
+// Timers added while the caller works through them wait for the next call.
+size_t timers_pop_due(struct Timers *t, long frame) {
+	size_t count = 0;
+	while (t->count > 0 && t->heap[0].frame <= frame) {
+		if (count == t->due_cap) {
+			t->due_cap = max(2 * t->due_cap, 1024);
+			t->due = realloc(t->due, t->due_cap * sizeof(uint32_t));
+			if (t->due == NULL) {
+				printf("ERROR: Out of memory for timers\n");
+				exit(1);
+			}
+		}
+		t->due[count++] = timers_pop(t).owner;
+	}
+	// mostly in order already, all due on this frame, and t->due is still
+	// NULL if nothing has ever come due
+	if (count > 1) {
+		qsort(t->due, count, sizeof(uint32_t), cmp_timer_owner);
+	}
+	size_t unique = 0;
+	range (k, count) {
+		if (unique == 0 || t->due[k] != t->due[unique - 1]) {
+			t->due[unique++] = t->due[k];
+		}
+	}
+	return unique;
+}
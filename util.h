@@ -1,14 +1,44 @@
 #pragma once
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define range(i, max) for (size_t i = 0; (i) < (max); ++(i))
 
-#define rand_int(g) ((rand() % (2*(g)+1))-(g))
+// Counter based random numbers: each draw is a hash of (key, counter), so a
+// stream is just a key, and any number of independent streams can be split
+// off one seed without sharing state between them. Unlike rand() the same
+// seed gives the same numbers on every platform.
+struct Rng {
+	uint64_t key;
+	uint64_t counter;
+};
+
+// splitmix64 finalizer
+uint64_t mix64(uint64_t z) {
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+struct Rng rng_stream(uint64_t seed, uint64_t stream) {
+	struct Rng out;
+	out.key = mix64(seed ^ mix64(stream + 0x9e3779b97f4a7c15ULL));
+	out.counter = 0;
+	return out;
+}
+
+uint64_t rng_next(struct Rng *rng) {
+	rng->counter += 1;
+	return mix64(rng->key + rng->counter * 0x9e3779b97f4a7c15ULL);
+}
+
+#define rand_int(rng, g) ((num)(rng_next(rng) % (2*(g)+1))-(g))
 
 #define min(x, y) ((x) <= (y) ? (x) : (y))
 #define max(x, y) ((x) >= (y) ? (x) : (y))
@@ -18,30 +48,9 @@ typedef int64_t num;
 const num UNIT = UNIT_CTIME;
 const num NUM_GREATEST = INT64_MAX;
 
-// Newton-Raphson method of calculating 1/sqrt(x)
-// (calling it fast invsqrt would be a lie while I have a while loop)
-num invsqrt_nr(num x) {
-	if (!x) x = 1;
-	// scale^2 ~= UNIT / 2 ~= 1/sqrt(scrapqu)
-	num y = UNIT;
-	// @Performance count leading zeroes please
-	while (x*y/UNIT*y/UNIT > 3 * UNIT / 2) {
-		y = y * 5 / 7;
-	}
-	while (x*y/UNIT*y/UNIT < 2 * UNIT / 3) {
-		y = y * 7 / 5;
-	}
-	y = y * (UNIT * 3 / 2 - x*y/UNIT*y/UNIT/2)/UNIT;
-	y = y * (UNIT * 3 / 2 - x*y/UNIT*y/UNIT/2)/UNIT;
-	y = y * (UNIT * 3 / 2 - x*y/UNIT*y/UNIT/2)/UNIT;
-	if (x*y/UNIT*y/UNIT > 3 * UNIT / 2 || x*y/UNIT*y/UNIT < 2 * UNIT / 3) {
-		printf("invsqrt(%ld) = %ld\n", x, y);
-	}
-	return y;
-}
-
-num num_hypot(num x, num y) {
-	num qu = (x*x + y*y)/UNIT;
-	return qu * invsqrt_nr(qu) / UNIT;
+// monotonic wall clock, for timing frames rather than telling the time
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
 }
-